@@ -0,0 +1,17 @@
+#ifndef CHATHISTORY_H
+#define CHATHISTORY_H
+
+#include <QMetaType>
+
+#include "ChatMessageData.h"
+
+#include <memory>
+#include <vector>
+
+//Immutable messages passed from the worker thread to the model and the cache without copying.
+//The model copies them into its MessageStore columns once, snapshots are not kept after that
+using ChatHistory = std::shared_ptr<const std::vector<ChatMessageData>>;
+
+Q_DECLARE_METATYPE(ChatHistory)
+
+#endif // CHATHISTORY_H
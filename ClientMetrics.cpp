@@ -0,0 +1,234 @@
+#include "ClientMetrics.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSaveFile>
+
+#include <algorithm>
+
+#include <QDebug>
+
+const std::vector<qint64> LATENCY_BUCKET_BOUNDS = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000};
+
+QJsonObject compressionToJson(const CompressionMetrics& compression){
+    return QJsonObject{
+        {"frames", static_cast<qint64>(compression.frames)},
+        {"originalBytes", static_cast<qint64>(compression.originalBytes)},
+        {"compressedBytes", static_cast<qint64>(compression.compressedBytes)},
+        {"ratio", compression.originalBytes == 0 ? 0.0 :
+                  static_cast<double>(compression.compressedBytes) / compression.originalBytes},
+        {"timeUs", compression.time / 1000}
+    };
+}
+
+LatencyHistogram::LatencyHistogram() :
+    buckets(LATENCY_BUCKET_BOUNDS.size() + 1, 0),
+    count(0),
+    total(0),
+    max(0)
+{
+
+}
+
+void LatencyHistogram::add(const qint64 value)
+{
+    auto bound = std::lower_bound(LATENCY_BUCKET_BOUNDS.begin(), LATENCY_BUCKET_BOUNDS.end(), value);
+    ++buckets[bound - LATENCY_BUCKET_BOUNDS.begin()];
+    ++count;
+    total += value;
+    max = std::max(max, value);
+}
+
+qint64 LatencyHistogram::percentile(const double fraction) const
+{
+    if(count == 0){
+        return 0;
+    }
+
+    auto rank = static_cast<quint64>(fraction * count);
+    quint64 counted = 0;
+    for(size_t i = 0; i < LATENCY_BUCKET_BOUNDS.size(); ++i){
+        counted += buckets[i];
+        if(counted > rank){
+            return std::min(LATENCY_BUCKET_BOUNDS[i], max);
+        }
+    }
+    return max;
+}
+
+QJsonObject LatencyHistogram::toJson() const
+{
+    QJsonArray bucketCounts;
+    for(auto bucket : buckets){
+        bucketCounts.append(static_cast<qint64>(bucket));
+    }
+    QJsonArray bucketBounds;
+    for(auto bound : LATENCY_BUCKET_BOUNDS){
+        bucketBounds.append(bound);
+    }
+
+    return QJsonObject{
+        {"count", static_cast<qint64>(count)},
+        {"average", count == 0 ? 0.0 : static_cast<double>(total) / count},
+        {"p50", percentile(0.5)},
+        {"p95", percentile(0.95)},
+        {"p99", percentile(0.99)},
+        {"max", max},
+        {"bucketBounds", bucketBounds},
+        {"buckets", bucketCounts}
+    };
+}
+
+QJsonObject ClientMetricsSnapshot::toJson() const
+{
+    QJsonObject requestsObject;
+    for(auto it = requests.constBegin(); it != requests.constEnd(); ++it){
+        requestsObject.insert(it.key(), QJsonObject{
+            {"sent", static_cast<qint64>(it->sent)},
+            {"responses", static_cast<qint64>(it->responses)},
+            {"timeouts", static_cast<qint64>(it->timeouts)},
+            {"latencyMs", it->latency.toJson()}
+        });
+    }
+
+    QJsonObject timingsObject;
+    for(auto it = timings.constBegin(); it != timings.constEnd(); ++it){
+        timingsObject.insert(it.key(), it->toJson());
+    }
+
+    double seconds = uptime / 1000.0;
+    auto perSecond = [seconds](const quint64 count){
+        return seconds > 0 ? count / seconds : 0.0;
+    };
+
+    return QJsonObject{
+        {"uptimeMs", uptime},
+        {"requests", requestsObject},
+        {"timingsMs", timingsObject},
+        {"bytesSent", static_cast<qint64>(bytesSent)},
+        {"bytesReceived", static_cast<qint64>(bytesReceived)},
+        {"framesSent", static_cast<qint64>(framesSent)},
+        {"framesReceived", static_cast<qint64>(framesReceived)},
+        {"framesPerSecond", perSecond(framesSent + framesReceived)},
+        {"queueDepth", queueDepth},
+        {"maxQueueDepth", maxQueueDepth},
+        {"requestsInFlight", requestsInFlight},
+        {"connectionsLost", static_cast<qint64>(connectionsLost)},
+        {"reconnectAttempts", static_cast<qint64>(reconnectAttempts)},
+        {"notifications", static_cast<qint64>(notifications)},
+        {"notificationsPerSecond", perSecond(notifications)},
+        {"mergedNotifications", static_cast<qint64>(mergedNotifications)},
+        {"mergedHistoryRequests", static_cast<qint64>(mergedHistoryRequests)},
+        {"compression", compressionToJson(compression)},
+        {"decompression", compressionToJson(decompression)}
+    };
+}
+
+ClientMetrics::ClientMetrics()
+{
+    uptimeTimer.start();
+}
+
+void ClientMetrics::recordRequestSent(const QString &requestType, const int bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ++metrics.requests[requestType].sent;
+    ++metrics.framesSent;
+    metrics.bytesSent += bytes;
+}
+
+void ClientMetrics::recordResponse(const QString &requestType, const qint64 latency)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& requestMetrics = metrics.requests[requestType];
+    ++requestMetrics.responses;
+    requestMetrics.latency.add(latency);
+}
+
+void ClientMetrics::recordTimeout(const QString &requestType)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ++metrics.requests[requestType].timeouts;
+}
+
+void ClientMetrics::recordTiming(const QString &name, const qint64 time)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    metrics.timings[name].add(time);
+}
+
+void ClientMetrics::recordFrameReceived(const int bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ++metrics.framesReceived;
+    metrics.bytesReceived += bytes;
+}
+
+void ClientMetrics::recordQueueDepth(const int queued, const int inFlight)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    metrics.queueDepth = queued;
+    metrics.maxQueueDepth = std::max(metrics.maxQueueDepth, queued);
+    metrics.requestsInFlight = inFlight;
+}
+
+void ClientMetrics::recordConnectionLost()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ++metrics.connectionsLost;
+}
+
+void ClientMetrics::recordReconnectAttempt()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ++metrics.reconnectAttempts;
+}
+
+void ClientMetrics::recordNotification()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ++metrics.notifications;
+}
+
+void ClientMetrics::recordMergedNotifications(const int count)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    metrics.mergedNotifications += count;
+}
+
+void ClientMetrics::recordMergedHistoryRequest()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ++metrics.mergedHistoryRequests;
+}
+
+void ClientMetrics::recordCompression(const bool sent, const int originalBytes,
+                                      const int compressedBytes, const qint64 time)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& compression = sent ? metrics.compression : metrics.decompression;
+    ++compression.frames;
+    compression.originalBytes += originalBytes;
+    compression.compressedBytes += compressedBytes;
+    compression.time += time;
+}
+
+ClientMetricsSnapshot ClientMetrics::snapshot() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto snapshot = metrics;
+    snapshot.uptime = uptimeTimer.elapsed();
+    return snapshot;
+}
+
+bool ClientMetrics::saveSnapshot(const ClientMetricsSnapshot &snapshot, const QString &filePath)
+{
+    //Readers never see a half written file
+    QSaveFile file(filePath);
+    if(!file.open(QIODevice::WriteOnly)){
+        qWarning() << "Can't write metrics to " << filePath << ": " << file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(snapshot.toJson()).toJson(QJsonDocument::Indented));
+    return file.commit();
+}
@@ -0,0 +1,99 @@
+#ifndef CLIENTMETRICS_H
+#define CLIENTMETRICS_H
+
+#include <QString>
+#include <QMap>
+#include <QJsonObject>
+#include <QElapsedTimer>
+
+#include <vector>
+#include <mutex>
+
+//Counts of values up to each bucket bound in milliseconds, the last bucket has no bound
+struct LatencyHistogram{
+    LatencyHistogram();
+
+    void add(const qint64 value);
+    //Upper bound of the bucket holding the percentile, approximate by design
+    qint64 percentile(const double fraction) const;
+    QJsonObject toJson() const;
+
+    std::vector<quint64> buckets;
+    quint64 count;
+    qint64 total;
+    qint64 max;
+};
+
+struct RequestMetrics{
+    quint64 sent = 0;
+    quint64 responses = 0;
+    quint64 timeouts = 0;
+    LatencyHistogram latency;
+};
+
+struct CompressionMetrics{
+    quint64 frames = 0;
+    quint64 originalBytes = 0;
+    quint64 compressedBytes = 0;
+    qint64 time = 0;
+};
+
+//Copy of all metrics at one moment, safe to use on any thread
+struct ClientMetricsSnapshot{
+    qint64 uptime = 0;
+
+    QMap<QString, RequestMetrics> requests;
+    QMap<QString, LatencyHistogram> timings;
+
+    quint64 bytesSent = 0;
+    quint64 bytesReceived = 0;
+    quint64 framesSent = 0;
+    quint64 framesReceived = 0;
+
+    int queueDepth = 0;
+    int maxQueueDepth = 0;
+    int requestsInFlight = 0;
+
+    quint64 connectionsLost = 0;
+    quint64 reconnectAttempts = 0;
+
+    quint64 notifications = 0;
+    quint64 mergedNotifications = 0;
+    quint64 mergedHistoryRequests = 0;
+
+    CompressionMetrics compression;
+    CompressionMetrics decompression;
+
+    QJsonObject toJson() const;
+};
+
+//Filled by the worker thread and read by the GUI thread, every call takes the lock for a few counters only
+class ClientMetrics
+{
+public:
+    ClientMetrics();
+
+    void recordRequestSent(const QString& requestType, const int bytes);
+    void recordResponse(const QString& requestType, const qint64 latency);
+    void recordTimeout(const QString& requestType);
+    void recordTiming(const QString& name, const qint64 time);
+    void recordFrameReceived(const int bytes);
+    void recordQueueDepth(const int queued, const int inFlight);
+    void recordConnectionLost();
+    void recordReconnectAttempt();
+    void recordNotification();
+    void recordMergedNotifications(const int count);
+    void recordMergedHistoryRequest();
+    void recordCompression(const bool sent, const int originalBytes, const int compressedBytes, const qint64 time);
+
+    ClientMetricsSnapshot snapshot() const;
+
+    static bool saveSnapshot(const ClientMetricsSnapshot& snapshot, const QString& filePath);
+
+private:
+    mutable std::mutex mutex;
+    QElapsedTimer uptimeTimer;
+    ClientMetricsSnapshot metrics;
+};
+
+#endif // CLIENTMETRICS_H
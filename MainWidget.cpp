@@ -5,19 +5,21 @@
 
 #include <QHBoxLayout>
 #include <QMessageBox>
-#include <QScrollBar>
 #include <QToolBar>
 #include <QAction>
 #include <QSettings>
+#include <QShortcut>
 
 #include <QCloseEvent>
 
 #include "TcpClient.h"
 #include "MessageModel.h"
-#include "MessageItemDelegate.h"
+#include "MessageCache.h"
 #include "MessagesViewer.h"
 #include "SettingsWidget.h"
+#include "MetricsWidget.h"
 #include "Settings.h"
+#include "Trace.h"
 
 #include "NewChatMessageData.h"
 
@@ -25,6 +27,10 @@
 
 const QString MESSAGE_USERNAME_KEY = "Username";
 const QString MESSAGE_TEXT_KEY = "Text";
+const QString TIME_FORMAT = "dd.MM.yyyy hh:mm:ss";
+const int CACHED_MESSAGES_SHOWN_ON_START = 200;
+const int DEFAULT_HISTORY_PAGE_SIZE = 50;
+const int DEFAULT_HISTORY_PREFETCH_ROWS = 10;
 const QString ERROR_LABEL_STYLE = "QLabel{"
                                   "color: red;"
                                   "}";
@@ -48,28 +54,73 @@ bool reconnectRequiredForSettings(const std::set<Settings>& settings){
     return false;
 };
 
+TcpClientOptions loadClientOptions(const QSettings& settings){
+    TcpClientOptions options;
+    options.maxRequestsInFlight = settings.value("maxRequestsInFlight", options.maxRequestsInFlight).toInt();
+    options.requestTimeout = settings.value("requestTimeout", options.requestTimeout).toInt();
+    options.requestRetries = settings.value("requestRetries", options.requestRetries).toInt();
+    options.notificationDebounceInterval = settings.value("notificationDebounceInterval",
+                                                          options.notificationDebounceInterval).toInt();
+    options.notificationMaxLatency = settings.value("notificationMaxLatency",
+                                                    options.notificationMaxLatency).toInt();
+    options.useCborEncoding = settings.value("useCborEncoding", options.useCborEncoding).toBool();
+    options.useCompression = settings.value("useCompression", options.useCompression).toBool();
+    options.compressionThreshold = settings.value("compressionThreshold", options.compressionThreshold).toInt();
+    options.reconnectInitialDelay = settings.value("reconnectInitialDelay", options.reconnectInitialDelay).toInt();
+    options.reconnectMaxDelay = settings.value("reconnectMaxDelay", options.reconnectMaxDelay).toInt();
+    options.offlineQueueLimit = settings.value("offlineQueueLimit", options.offlineQueueLimit).toInt();
+    options.chatMessageBatchSize = settings.value("chatMessageBatchSize", options.chatMessageBatchSize).toInt();
+    options.chatMessageBatchLinger = settings.value("chatMessageBatchLinger",
+                                                    options.chatMessageBatchLinger).toInt();
+    options.metricsDumpFile = settings.value("metricsDumpFile").toString();
+    options.metricsDumpInterval = settings.value("metricsDumpInterval", options.metricsDumpInterval).toInt();
+    return options;
+}
+
 MainWidget::MainWidget(QWidget *parent)
     : QWidget(parent),
     settingsAction(new QAction(QIcon("://resources/icons/settings.png"), "")),
+    metricsAction(new QAction(tr("Metrics"))),
     widgetLayout(new QVBoxLayout(this)),
-    chatHistoryView(new QListView()),
-    messageItemDelegate(new MessageItemDelegate(this)),
     messagesViewer(new MessagesViewer(this)),
     messageErrorLabel(new QLabel(tr("Message empty!"))),
+    connectionStatusLabel(new QLabel(tr("Connection lost, reconnecting..."))),
     messageField(new QTextEdit()),
     sendButton(new QPushButton(tr("sendButton"))),
     settingsWidget(std::make_shared<SettingsWidget>()),
     tcpClient(new TcpClient(this)),
     messageModel(new MessageModel(this)),
-    disconnecting(false)
+    metricsWidget(std::make_unique<MetricsWidget>(tcpClient, messageModel)),
+    cacheThread(new QThread(this)),
+    cacheContext(new QObject()),
+    disconnecting(false),
+    switchingServer(false),
+    historyPageSize(DEFAULT_HISTORY_PAGE_SIZE),
+    loadingOlderMessages(false),
+    olderMessagesRequestId(0),
+    hasOlderMessages(false)
 {
     setupLayout();
 
+    cacheThread->setObjectName("MessageCache");
+    cacheContext->moveToThread(cacheThread);
+    cacheThread->start();
+
     connect(sendButton, &QPushButton::pressed, this, &MainWidget::onSendButtonPressed);
     connect(settingsAction, &QAction::triggered, this, [this](){
         setDisabled(true);
         settingsWidget->show();
     });
+    connect(metricsAction, &QAction::triggered, this, [this](){
+        metricsWidget->show();
+        metricsWidget->raise();
+    });
+    //The metrics action is hidden for users, the shortcut reveals it for debugging
+    auto metricsShortcut = new QShortcut(QKeySequence(tr("Ctrl+Shift+D")), this);
+    connect(metricsShortcut, &QShortcut::activated, this, [this](){
+        metricsAction->setVisible(true);
+        metricsAction->trigger();
+    });
     connect(settingsWidget.get(), &SettingsWidget::settingsSaved,
             this, &MainWidget::onSettingsSaved);
     connect(settingsWidget.get(), &SettingsWidget::canceled,
@@ -77,25 +128,46 @@ MainWidget::MainWidget(QWidget *parent)
 
     connect(tcpClient, &TcpClient::newSessionInitiated,
             this, &MainWidget::onNewSessionInitiated);
+    connect(tcpClient, &TcpClient::sessionResumed,
+            this, &MainWidget::onSessionResumed);
     connect(tcpClient, &TcpClient::chatMessageSentSuccess,
             this, &MainWidget::onChatMessageSentSuccess);
     connect(tcpClient, &TcpClient::chatHistoryReceived,
             this, &MainWidget::onChatHistoryReceived);
+    connect(tcpClient, &TcpClient::newChatMessagesReceived,
+            this, &MainWidget::onNewChatMessagesReceived);
+    connect(tcpClient, &TcpClient::chatHistoryPageReceived,
+            this, &MainWidget::onChatHistoryPageReceived);
+    connect(messagesViewer, &MessagesViewer::olderMessagesRequested,
+            this, &MainWidget::onOlderMessagesRequested);
     connect(tcpClient, &TcpClient::startedSuccessfully,
             this, &MainWidget::onStartedSuccessfully);
 
     connect(tcpClient, &TcpClient::stopped, this, &MainWidget::onTcpClientStopped);
+    connect(tcpClient, &TcpClient::connectionLost, this, &MainWidget::onConnectionLost);
+    connect(tcpClient, &TcpClient::requestFailed, this, &MainWidget::onRequestFailed);
     connect(tcpClient, &TcpClient::chatHasBeenUpdated, this, &MainWidget::onChatUpdated);
 
     QSettings settings;
     username = settings.value("username").toString();
+    metricsAction->setVisible(settings.value("showMetricsAction", false).toBool());
+    historyPageSize = settings.value("historyPageSize", DEFAULT_HISTORY_PAGE_SIZE).toInt();
+    messagesViewer->setPrefetchDistance(settings.value("historyPrefetchRows",
+                                                       DEFAULT_HISTORY_PREFETCH_ROWS).toInt());
     auto serverHost = settings.value("serverHost").toString();
     auto serverPort = settings.value("serverPort").toInt();
+    tcpClient->setOptions(loadClientOptions(settings));
+    loadCachedChat(serverHost, serverPort);
     tcpClient->start(serverHost, serverPort);
 }
 
 MainWidget::~MainWidget()
 {
+    //Queued cache writes are finished before the thread is stopped
+    QMetaObject::invokeMethod(cacheContext, [](){}, Qt::BlockingQueuedConnection);
+    cacheThread->quit();
+    cacheThread->wait();
+    delete cacheContext;
 }
 
 void MainWidget::closeEvent(QCloseEvent *event)
@@ -110,25 +182,68 @@ void MainWidget::closeEvent(QCloseEvent *event)
     }
 }
 
-void MainWidget::paintEvent(QPaintEvent *event)
+void MainWidget::changeEvent(QEvent *event)
 {
-    QWidget::paintEvent(event);
+    QWidget::changeEvent(event);
 
-    //Only here on first launch scrollbar will be "visible"
-    auto delegateWidth = chatHistoryView->width();
-    if(chatHistoryView->verticalScrollBar()->isVisible()){
-        delegateWidth -= chatHistoryView->verticalScrollBar()->width();
-    }
-    if(delegateWidth != messageItemDelegate->getWidth()){
-        messageItemDelegate->setWidth(delegateWidth);
-        messageModel->wantsUpdate();
+    if(event->type() == QEvent::LocaleChange){
+        messageModel->setTimeFormat(TIME_FORMAT, locale());
     }
 }
 
 void MainWidget::cleanChat()
 {
-    messageModel->setMessages(std::vector<ChatMessageData>());
-    messagesViewer->setDataFromModel(messageModel);
+    messageModel->clear();
+    sessionId = QUuid();
+    loadingOlderMessages = false;
+    hasOlderMessages = false;
+}
+
+void MainWidget::loadCachedChat(const QString &host, const quint16 port)
+{
+    TRACE_SCOPE("MainWidget::loadCachedChat");
+    messageCache = std::make_shared<MessageCache>(host, port);
+    //Writes still queued for the previous cache are done before this one is read
+    ChatHistory cachedMessages;
+    QMetaObject::invokeMethod(cacheContext, [cache = messageCache](){
+        return cache->load(CACHED_MESSAGES_SHOWN_ON_START);
+    }, Qt::BlockingQueuedConnection, &cachedMessages);
+    if(cachedMessages != nullptr){
+        messageModel->setMessages(cachedMessages);
+        messagesViewer->scrollToBottom();
+        //Only the newest cached messages are shown, older ones are fetched from server on scroll
+        hasOlderMessages = true;
+    }
+}
+
+void MainWidget::replaceCachedMessages(const ChatHistory &messages)
+{
+    //Messages are immutable, so the cache thread shares them instead of a copy
+    QMetaObject::invokeMethod(cacheContext, [cache = messageCache, messages](){
+        TRACE_SCOPE("MessageCache::replace");
+        cache->replace(*messages);
+    }, Qt::QueuedConnection);
+}
+
+void MainWidget::appendCachedMessages(const ChatHistory &messages)
+{
+    QMetaObject::invokeMethod(cacheContext, [cache = messageCache, messages](){
+        TRACE_SCOPE("MessageCache::append");
+        cache->append(*messages);
+    }, Qt::QueuedConnection);
+}
+
+void MainWidget::requestChatUpdate()
+{
+    //Only messages after the last shown one are requested, including those loaded from cache
+    auto lastMessageId = messageModel->lastMessageId();
+    if(lastMessageId.isEmpty()){
+        //Empty chat starts from the newest page, older ones are loaded while scrolling up
+        tcpClient->addGetChatPageRequest(sessionId, QString(), historyPageSize);
+    }
+    else{
+        tcpClient->addGetChatUpdatesRequest(sessionId, lastMessageId);
+    }
 }
 
 void MainWidget::setupLayout()
@@ -139,6 +254,7 @@ void MainWidget::setupLayout()
     auto spacer = new QWidget();
     spacer->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Preferred);
     toolBar->addWidget(spacer);
+    toolBar->addAction(metricsAction);
     toolBar->addAction(settingsAction);
     widgetLayout->addWidget(toolBar);
 
@@ -147,7 +263,11 @@ void MainWidget::setupLayout()
     messageErrorLabel->setStyleSheet(ERROR_LABEL_STYLE);
     messageErrorLabel->hide();
 
-    messagesViewer->setDataFromModel(messageModel);
+    connectionStatusLabel->setStyleSheet(ERROR_LABEL_STYLE);
+    connectionStatusLabel->hide();
+    widgetContentLayout->addWidget(connectionStatusLabel);
+
+    messagesViewer->setModel(messageModel);
     widgetContentLayout->addWidget(messagesViewer);
 
     widgetContentLayout->addSpacing(5);
@@ -171,28 +291,54 @@ void MainWidget::setupLayout()
 
 void MainWidget::onSendButtonPressed()
 {
+    TRACE_SCOPE("MainWidget::onSendButtonPressed");
     if(messageField->toPlainText().isEmpty()){
         messageErrorLabel->show();
         return;
     }
 
     NewChatMessageData message(username, messageField->toPlainText());
-    tcpClient->addSendChatMessageRequest(sessionId, message);
+    auto requestId = tcpClient->addSendChatMessageRequest(sessionId, message);
+    if(requestId == 0){
+        return;
+    }
+
+    //Message is shown right away and replaced by the server one when it arrives with chat updates
+    messageModel->addPendingMessage(username, messageField->toPlainText(), requestId);
+    messagesViewer->scrollToBottom();
+    messageField->clear();
+    messageErrorLabel->hide();
 }
 
-void MainWidget::onChatMessageSentSuccess()
+void MainWidget::onChatMessageSentSuccess(quint64 requestId, const QString &messageId)
 {
+    TRACE_SCOPE("MainWidget::onChatMessageSentSuccess");
+    if(switchingServer){
+        return;
+    }
     qDebug() << "Chat message sent successfully";
+    messageModel->confirmPendingMessage(requestId, messageId);
 }
 
 void MainWidget::onStartedSuccessfully()
 {
+    switchingServer = false;
+    //After reconnect the previous session is resumed if server still keeps it
+    if(!sessionId.isNull()){
+        tcpClient->resumeSession(userId, username, sessionId, messageModel->lastMessageId());
+        return;
+    }
+
     userId = QUuid::createUuid();
     tcpClient->initSession(userId, username);
 }
 
 void MainWidget::onNewSessionInitiated(bool initSuccess, const QUuid &receivedUserId, const QUuid &receivedSessionId)
 {
+    if(switchingServer){
+        return;
+    }
+
     if(!initSuccess){
         QMessageBox::warning(this, tr("Login error"), tr("Invalid username"));
         tcpClient->stop();//TODO: Implement login/logout logic
@@ -206,20 +352,107 @@ void MainWidget::onNewSessionInitiated(bool initSuccess, const QUuid &receivedUs
     }
 
     sessionId = receivedSessionId;
+    connectionStatusLabel->hide();
 
     tcpClient->confirmSession(userId, sessionId);
-    tcpClient->addGetChatRequest(sessionId);
+    requestChatUpdate();
 }
 
-void MainWidget::onChatHistoryReceived(const std::vector<ChatMessageData> chatHistory)
+void MainWidget::onSessionResumed(const QUuid &resumedUserId, const QUuid &resumedSessionId)
 {
-    messageModel->setMessages(std::move(chatHistory));
-    messagesViewer->setDataFromModel(messageModel);
-    messagesViewer->verticalScrollBar()->setValue(messagesViewer->verticalScrollBar()->maximum());
+    TRACE_SCOPE("MainWidget::onSessionResumed");
+    if(resumedUserId != userId || resumedSessionId != sessionId){
+        qWarning() << "Unexpected session resumed: " << resumedSessionId;
+    }
+    connectionStatusLabel->hide();
+}
+
+void MainWidget::onChatHistoryReceived(const ChatHistory &chatHistory)
+{
+    TRACE_SCOPE("MainWidget::onChatHistoryReceived");
+    if(switchingServer){
+        return;
+    }
+    hasOlderMessages = false;
+    messageModel->setMessages(chatHistory);
+    messagesViewer->scrollToBottom();
+    replaceCachedMessages(chatHistory);
+}
+
+void MainWidget::onNewChatMessagesReceived(const ChatHistory &newMessages)
+{
+    TRACE_SCOPE("MainWidget::onNewChatMessagesReceived");
+    if(switchingServer){
+        return;
+    }
+    messageModel->appendMessages(newMessages);
+    messagesViewer->scrollToBottom();
+    appendCachedMessages(newMessages);
+}
+
+void MainWidget::onChatHistoryPageReceived(const ChatHistory &page, const QString &beforeMessageId,
+                                           bool pageHasOlderMessages)
+{
+    TRACE_SCOPE("MainWidget::onChatHistoryPageReceived");
+    if(switchingServer){
+        return;
+    }
+    if(beforeMessageId.isEmpty()){
+        //Another newest page may have filled the chat meanwhile, its known messages are skipped
+        if(messageModel->getStore().isEmpty()){
+            hasOlderMessages = pageHasOlderMessages;
+            messageModel->setMessages(page);
+            replaceCachedMessages(page);
+        }
+        else{
+            messageModel->appendMessages(page);
+            appendCachedMessages(page);
+        }
+        messagesViewer->scrollToBottom();
+        return;
+    }
+
+    loadingOlderMessages = false;
+    //Page of a chat replaced meanwhile doesn't fit above its first row
+    if(beforeMessageId != messageModel->oldestMessageId()){
+        qDebug() << "Outdated page of older messages is dropped";
+        return;
+    }
+    hasOlderMessages = pageHasOlderMessages;
+    messageModel->prependMessages(page);
+}
+
+void MainWidget::onOlderMessagesRequested()
+{
+    TRACE_SCOPE("MainWidget::onOlderMessagesRequested");
+    if(loadingOlderMessages || !hasOlderMessages || !tcpClient->isStarted()){
+        return;
+    }
+
+    olderMessagesRequestId = tcpClient->addGetChatPageRequest(sessionId, messageModel->oldestMessageId(),
+                                                              historyPageSize);
+    loadingOlderMessages = olderMessagesRequestId != 0;
+}
+
+void MainWidget::onRequestFailed(quint64 requestId, RequestFailure failure)
+{
+    TRACE_SCOPE("MainWidget::onRequestFailed");
+    qWarning() << "Request " << requestId << " failed: " << static_cast<int>(failure);
+
+    //Failed message is kept with its status instead of disappearing
+    messageModel->failPendingMessage(requestId);
+
+    //Failed page can be requested again on the next scroll
+    if(requestId == olderMessagesRequestId){
+        loadingOlderMessages = false;
+        olderMessagesRequestId = 0;
+    }
 }
 
 void MainWidget::onTcpClientStopped()
 {
+    switchingServer = false;
+    connectionStatusLabel->hide();
     if(disconnecting){
         close();
         return;
@@ -231,9 +464,19 @@ void MainWidget::onTcpClientStopped()
     }
 }
 
+void MainWidget::onConnectionLost()
+{
+    //Client reconnects by itself, messages written meanwhile are sent after that
+    connectionStatusLabel->show();
+}
+
 void MainWidget::onChatUpdated()
 {
-    tcpClient->addGetChatRequest(sessionId);
+    TRACE_SCOPE("MainWidget::onChatUpdated");
+    if(switchingServer){
+        return;
+    }
+    requestChatUpdate();
 }
 
 void MainWidget::onSettingsSaved(const std::set<Settings> &changedSettings)
@@ -248,10 +491,14 @@ void MainWidget::onSettingsSaved(const std::set<Settings> &changedSettings)
 
     if(!tcpClient->isStarted()){
         cleanChat();
+        loadCachedChat(serverHost, serverPort);
         tcpClient->start(serverHost, serverPort);
     }
     else if(reconnectRequiredForSettings(changedSettings)){
+        //The old worker may still deliver responses before it stops, they belong to the old chat
+        switchingServer = true;
         cleanChat();
+        loadCachedChat(serverHost, serverPort);
         tcpClient->restart(serverHost, serverPort);
     }
 
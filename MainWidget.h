@@ -4,22 +4,25 @@
 #include <QWidget>
 
 #include <QVBoxLayout>
-#include <QListView>
 #include <QLabel>
 #include <QLineEdit>
 #include <QTextEdit>
 #include <QPushButton>
 #include <QUuid>
+#include <QThread>
 
-#include "ChatMessageData.h"
+#include "ChatHistory.h"
+#include "RequestFailure.h"
 
 #include <set>
+#include <memory>
 
-class MessageItemDelegate;
 class TcpClient;
 class MessageModel;
 class MessagesViewer;
 class SettingsWidget;
+class MetricsWidget;
+class MessageCache;
 
 enum class Settings;
 
@@ -33,20 +36,26 @@ public:
 
 protected:
     virtual void closeEvent(QCloseEvent *event) override;
+    virtual void changeEvent(QEvent *event) override;
 
 private:
     QAction* settingsAction;
+    QAction* metricsAction;
     QVBoxLayout* widgetLayout;
-    QListView* chatHistoryView;
-    MessageItemDelegate* messageItemDelegate;
     MessagesViewer* messagesViewer;
     QLabel* messageErrorLabel;
+    QLabel* connectionStatusLabel;
     QTextEdit* messageField;
     QPushButton* sendButton;
     std::shared_ptr<SettingsWidget> settingsWidget;
 
     TcpClient* tcpClient;
     MessageModel* messageModel;
+    std::unique_ptr<MetricsWidget> metricsWidget;
+    //Cache files are read and written on their own thread, through the context living there
+    QThread* cacheThread;
+    QObject* cacheContext;
+    std::shared_ptr<MessageCache> messageCache;
 
     QString username;
 
@@ -54,20 +63,35 @@ private:
     QUuid sessionId;
 
     bool disconnecting;
+    //Responses of the previous server are dropped until the client has been restarted
+    bool switchingServer;
 
-    virtual void paintEvent(QPaintEvent *event) override;
+    int historyPageSize;
+    bool loadingOlderMessages;
+    quint64 olderMessagesRequestId;
+    bool hasOlderMessages;
 
     void cleanChat();
+    void loadCachedChat(const QString& host, const quint16 port);
+    void replaceCachedMessages(const ChatHistory& messages);
+    void appendCachedMessages(const ChatHistory& messages);
+    void requestChatUpdate();
     void setupLayout();
 
 private slots:
     void onSendButtonPressed();
-    void onChatMessageSentSuccess();
+    void onChatMessageSentSuccess(quint64 requestId, const QString& messageId);
 
     void onStartedSuccessfully();
     void onNewSessionInitiated(bool initSuccess, const QUuid& receivedUserId, const QUuid& receivedSessionId);
-    void onChatHistoryReceived(const std::vector<ChatMessageData> chatHistory);
+    void onSessionResumed(const QUuid& resumedUserId, const QUuid& resumedSessionId);
+    void onChatHistoryReceived(const ChatHistory& chatHistory);
+    void onNewChatMessagesReceived(const ChatHistory& newMessages);
+    void onChatHistoryPageReceived(const ChatHistory& page, const QString& beforeMessageId, bool pageHasOlderMessages);
+    void onOlderMessagesRequested();
+    void onRequestFailed(quint64 requestId, RequestFailure failure);
     void onTcpClientStopped();
+    void onConnectionLost();
     void onChatUpdated();
 
     void onSettingsSaved(const std::set<Settings>& changedSettings);
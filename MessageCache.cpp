@@ -0,0 +1,287 @@
+#include "MessageCache.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QRegularExpression>
+
+#include "ChatMessageData.h"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <iterator>
+
+const quint32 DATA_FILE_MAGIC = 0x51434D44;
+const quint32 INDEX_FILE_MAGIC = 0x51434D49;
+const quint16 CACHE_VERSION = 1;
+const qint64 DATA_HEADER_SIZE = sizeof(quint32) + sizeof(quint16);
+const quint32 CHECKPOINT_INTERVAL = 64;
+const quint32 MAX_RECORD_SIZE = 16 * 1024 * 1024;
+const size_t RECENT_MESSAGE_IDS_KEPT = 1024;
+
+MessageCache::MessageCache(const QString &host, const quint16 port) :
+    messagesCount(0),
+    dataSize(0)
+{
+    auto cacheDirectory = QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/cache";
+    QDir().mkpath(cacheDirectory);
+
+    auto fileName = QString("%1_%2").arg(host).arg(port);
+    fileName.replace(QRegularExpression("[^A-Za-z0-9.\\-_]"), "_");
+    dataFilePath = cacheDirectory + "/" + fileName + ".messages";
+    indexFilePath = cacheDirectory + "/" + fileName + ".index";
+}
+
+ChatHistory MessageCache::load(const int lastMessagesCount)
+{
+    if(!QFile::exists(dataFilePath) || !readIndex()){
+        remove();
+        return nullptr;
+    }
+
+    QFile dataFile(dataFilePath);
+    if(!dataFile.open(QIODevice::ReadOnly) || static_cast<quint64>(dataFile.size()) < dataSize){
+        qWarning() << "Message cache data is missing, dropping cache";
+        remove();
+        return nullptr;
+    }
+
+    QDataStream stream(&dataFile);
+    quint32 magic = 0;
+    quint16 version = 0;
+    stream >> magic >> version;
+    if(magic != DATA_FILE_MAGIC || version != CACHE_VERSION){
+        qWarning() << "Unknown message cache format, dropping cache";
+        remove();
+        return nullptr;
+    }
+
+    //Reading starts from the nearest checkpoint before the first requested message
+    quint32 firstMessage = messagesCount - std::min<quint32>(messagesCount, lastMessagesCount);
+    quint32 checkpoint = firstMessage / CHECKPOINT_INTERVAL;
+    quint32 messageNumber = checkpoint * CHECKPOINT_INTERVAL;
+    if(checkpoint < checkpoints.size()){
+        dataFile.seek(checkpoints.at(checkpoint));
+    }
+
+    std::vector<ChatMessageData> messages;
+    messages.reserve(messagesCount - firstMessage);
+    while(messageNumber < messagesCount){
+        ChatMessageData message;
+        if(static_cast<quint64>(dataFile.pos()) >= dataSize || !readMessage(stream, message)){
+            qWarning() << "Message cache is damaged, dropping cache";
+            remove();
+            return nullptr;
+        }
+        rememberMessageId(message.id);
+        if(messageNumber >= firstMessage){
+            messages.push_back(std::move(message));
+        }
+        ++messageNumber;
+    }
+
+    if(!messages.empty() && messages.back().id != lastMessageId){
+        qWarning() << "Message cache index doesn't match data, dropping cache";
+        remove();
+        return nullptr;
+    }
+
+    qDebug() << "Loaded" << messages.size() << "of" << messagesCount << "cached messages";
+    return std::make_shared<const std::vector<ChatMessageData>>(std::move(messages));
+}
+
+bool MessageCache::replace(const std::vector<ChatMessageData> &messages)
+{
+    messagesCount = 0;
+    dataSize = 0;
+    checkpoints.clear();
+    lastMessageId.clear();
+    forgetMessageIds();
+    return writeMessages(messages.data(), messages.size(), true);
+}
+
+bool MessageCache::append(const std::vector<ChatMessageData> &messages)
+{
+    if(messagesCount == 0){
+        return replace(messages);
+    }
+
+    //Overlapping updates and pages may repeat any of the newest cached messages
+    auto isCached = [this](const ChatMessageData& message){
+        return recentMessageIdSet.contains(message.id);
+    };
+    if(std::none_of(messages.begin(), messages.end(), isCached)){
+        return writeMessages(messages.data(), messages.size(), false);
+    }
+
+    std::vector<ChatMessageData> newMessages;
+    std::remove_copy_if(messages.begin(), messages.end(), std::back_inserter(newMessages), isCached);
+    if(newMessages.empty()){
+        return true;
+    }
+    return writeMessages(newMessages.data(), newMessages.size(), false);
+}
+
+void MessageCache::remove()
+{
+    QFile::remove(dataFilePath);
+    QFile::remove(indexFilePath);
+    messagesCount = 0;
+    dataSize = 0;
+    checkpoints.clear();
+    lastMessageId.clear();
+    forgetMessageIds();
+}
+
+bool MessageCache::readIndex()
+{
+    QFile indexFile(indexFilePath);
+    if(!indexFile.open(QIODevice::ReadOnly)){
+        return false;
+    }
+
+    QDataStream stream(&indexFile);
+    quint32 magic = 0;
+    quint16 version = 0;
+    quint32 checkpointsCount = 0;
+    stream >> magic >> version >> messagesCount >> dataSize >> lastMessageId >> checkpointsCount;
+    if(stream.status() != QDataStream::Ok || magic != INDEX_FILE_MAGIC || version != CACHE_VERSION ||
+       checkpointsCount != (messagesCount + CHECKPOINT_INTERVAL - 1) / CHECKPOINT_INTERVAL){
+        qWarning() << "Message cache index is damaged";
+        return false;
+    }
+
+    checkpoints.resize(checkpointsCount);
+    for(auto& checkpoint : checkpoints){
+        stream >> checkpoint;
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+bool MessageCache::writeIndex()
+{
+    QSaveFile indexFile(indexFilePath);
+    if(!indexFile.open(QIODevice::WriteOnly)){
+        qWarning() << "Failed to write message cache index: " << indexFile.errorString();
+        return false;
+    }
+
+    QDataStream stream(&indexFile);
+    stream << INDEX_FILE_MAGIC << CACHE_VERSION << messagesCount << dataSize << lastMessageId
+           << static_cast<quint32>(checkpoints.size());
+    for(auto checkpoint : checkpoints){
+        stream << checkpoint;
+    }
+    return indexFile.commit();
+}
+
+bool MessageCache::writeMessages(const ChatMessageData *messages, const int count, const bool truncate)
+{
+    QFile dataFile(dataFilePath);
+    auto openMode = truncate ? QIODevice::WriteOnly | QIODevice::Truncate : QIODevice::ReadWrite;
+    if(!dataFile.open(openMode)){
+        qWarning() << "Failed to open message cache: " << dataFile.errorString();
+        return false;
+    }
+
+    QDataStream stream(&dataFile);
+    if(truncate){
+        stream << DATA_FILE_MAGIC << CACHE_VERSION;
+        dataSize = DATA_HEADER_SIZE;
+    }
+    else if(static_cast<quint64>(dataFile.size()) < dataSize){
+        qWarning() << "Message cache data is missing, dropping cache";
+        dataFile.close();
+        remove();
+        return false;
+    }
+    else{
+        //Anything after the indexed size was not completely written and is overwritten
+        dataFile.seek(dataSize);
+    }
+
+    for(int i = 0; i < count; ++i){
+        if(messagesCount % CHECKPOINT_INTERVAL == 0){
+            checkpoints.push_back(dataFile.pos());
+        }
+
+        auto record = serializeMessage(messages[i]);
+        stream << static_cast<quint32>(record.size()) << recordChecksum(record);
+        stream.writeRawData(record.constData(), record.size());
+
+        ++messagesCount;
+        lastMessageId = messages[i].id;
+        rememberMessageId(lastMessageId);
+    }
+
+    if(stream.status() != QDataStream::Ok || !dataFile.flush()){
+        qWarning() << "Failed to write message cache: " << dataFile.errorString();
+        remove();
+        return false;
+    }
+    dataSize = dataFile.pos();
+    dataFile.resize(dataSize);
+    dataFile.close();
+
+    return writeIndex();
+}
+
+void MessageCache::rememberMessageId(const QString &id)
+{
+    if(recentMessageIdSet.contains(id)){
+        return;
+    }
+    recentMessageIds.push_back(id);
+    recentMessageIdSet.insert(id);
+    if(recentMessageIds.size() > RECENT_MESSAGE_IDS_KEPT){
+        recentMessageIdSet.remove(recentMessageIds.front());
+        recentMessageIds.pop_front();
+    }
+}
+
+void MessageCache::forgetMessageIds()
+{
+    recentMessageIds.clear();
+    recentMessageIdSet.clear();
+}
+
+quint16 MessageCache::recordChecksum(const QByteArray &record)
+{
+    //Both overloads compute the same CRC-16, only the pointer one exists in Qt 5
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+    return qChecksum(record);
+#else
+    return qChecksum(record.constData(), record.size());
+#endif
+}
+
+QByteArray MessageCache::serializeMessage(const ChatMessageData &message)
+{
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream << message.id << message.username << message.text << message.postTime;
+    return record;
+}
+
+bool MessageCache::readMessage(QDataStream &stream, ChatMessageData &message)
+{
+    quint32 recordSize = 0;
+    quint16 checksum = 0;
+    stream >> recordSize >> checksum;
+    if(stream.status() != QDataStream::Ok || recordSize > MAX_RECORD_SIZE){
+        return false;
+    }
+
+    QByteArray record(recordSize, Qt::Uninitialized);
+    if(stream.readRawData(record.data(), recordSize) != static_cast<int>(recordSize) ||
+       recordChecksum(record) != checksum){
+        return false;
+    }
+
+    QDataStream recordStream(record);
+    recordStream >> message.id >> message.username >> message.text >> message.postTime;
+    return recordStream.status() == QDataStream::Ok;
+}
@@ -0,0 +1,52 @@
+#ifndef MESSAGECACHE_H
+#define MESSAGECACHE_H
+
+#include <QString>
+#include <QSet>
+
+#include "ChatHistory.h"
+
+#include <deque>
+#include <vector>
+
+class QDataStream;
+
+//Append-only file of received messages of one server, with an index of record offsets
+//so the newest messages can be read without going through the whole file.
+//It isn't thread safe, but may be used from any one thread at a time
+class MessageCache
+{
+public:
+    MessageCache(const QString& host, const quint16 port);
+
+    //Returns nullptr if there is no cache or it is damaged, damaged files are removed
+    ChatHistory load(const int lastMessagesCount);
+
+    bool replace(const std::vector<ChatMessageData>& messages);
+    bool append(const std::vector<ChatMessageData>& messages);
+    void remove();
+
+private:
+    QString dataFilePath;
+    QString indexFilePath;
+
+    quint32 messagesCount;
+    quint64 dataSize;
+    std::vector<quint64> checkpoints;
+    QString lastMessageId;
+    //Ids of the newest cached messages, so repeated ones are not appended again
+    std::deque<QString> recentMessageIds;
+    QSet<QString> recentMessageIdSet;
+
+    bool readIndex();
+    bool writeIndex();
+    bool writeMessages(const ChatMessageData* messages, const int count, const bool truncate);
+    void rememberMessageId(const QString& id);
+    void forgetMessageIds();
+
+    static quint16 recordChecksum(const QByteArray& record);
+    static QByteArray serializeMessage(const ChatMessageData& message);
+    static bool readMessage(QDataStream& stream, ChatMessageData& message);
+};
+
+#endif // MESSAGECACHE_H
@@ -7,7 +7,9 @@ enum MessageDataRole{
     Id= Qt::ItemDataRole::UserRole + 1,
     Username,
     Text,
-    Time
+    Time,
+    TimeText,
+    Status
 };
 
 #endif // MESSAGEDATAROLE_H
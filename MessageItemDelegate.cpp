@@ -2,73 +2,114 @@
 
 #include <QPainter>
 #include <QFontMetrics>
-#include <QDateTime>
+#include <QTransform>
 
 #include "MessageDataRole.h"
+#include "MessageStatus.h"
+#include "Trace.h"
+
+#include <algorithm>
 
 #include <QDebug>
 
-const int HEADER_HEIGHT = 20;
-const QString dateFormat = "dd.MM.yyyy hh:mm:ss";
+const int MESSAGE_MARGIN = 5;
+const int MESSAGE_PADDING = 9;
+const int HEADER_SPACING = 6;
+const qreal MESSAGE_BORDER_RADIUS = 5;
+const QColor MESSAGE_BACKGROUND_COLOR(0xE0, 0xE0, 0xE0);
+const QColor MESSAGE_BORDER_COLOR(0xAA, 0xAA, 0xAA);
+const QColor PENDING_MESSAGE_BACKGROUND_COLOR(0xF0, 0xF0, 0xF0);
+const QColor FAILED_MESSAGE_STATUS_COLOR(0xD0, 0x00, 0x00);
+
+const int WIDTH_BUCKET = 16;
+const int SIZE_HINT_CACHE_MESSAGES = 100000;
+const int LAYOUT_CACHE_MESSAGES = 500;
 
 MessageItemDelegate::MessageItemDelegate(QObject *parent) :
     QStyledItemDelegate(parent),
-    width(0)
+    width(0),
+    sizeHintCache(SIZE_HINT_CACHE_MESSAGES),
+    layoutCache(LAYOUT_CACHE_MESSAGES),
+    lastFontId(-1),
+    sizeHintCacheHits(0),
+    sizeHintCacheMisses(0)
 {
 
 }
 
 void MessageItemDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const
 {
-    QStyleOptionViewItem styledOption(option);
-    initStyleOption(&styledOption, index);
+    TRACE_SCOPE("MessageItemDelegate::paint");
     painter->save();
-
-    painter->drawText(option.rect, index.data(MessageDataRole::Time).toDateTime().toString(dateFormat));
-
-    auto messageTextDrawRect = option.rect.translated(0, HEADER_HEIGHT);
-    painter->drawText(messageTextDrawRect, index.data(MessageDataRole::Text).toString());
+    painter->setRenderHint(QPainter::Antialiasing);
+    painter->setFont(option.font);
+
+    auto status = static_cast<MessageStatus>(index.data(MessageDataRole::Status).toInt());
+
+    auto bubbleRect = option.rect.adjusted(MESSAGE_MARGIN, MESSAGE_MARGIN, -MESSAGE_MARGIN, 0);
+    painter->setPen(MESSAGE_BORDER_COLOR);
+    painter->setBrush(status == MessageStatus::Confirmed ? MESSAGE_BACKGROUND_COLOR
+                                                         : PENDING_MESSAGE_BACKGROUND_COLOR);
+    painter->drawRoundedRect(QRectF(bubbleRect).adjusted(0.5, 0.5, -0.5, -0.5),
+                             MESSAGE_BORDER_RADIUS, MESSAGE_BORDER_RADIUS);
+
+    auto layout = messageLayout(option, index);
+    painter->setPen(option.palette.color(QPalette::WindowText));
+    auto contentRect = bubbleRect.adjusted(MESSAGE_PADDING, MESSAGE_PADDING, -MESSAGE_PADDING, -MESSAGE_PADDING);
+    painter->drawStaticText(contentRect.topLeft(), layout->username);
+
+    //Pending and failed messages show their status in place of the time
+    if(status == MessageStatus::Failed){
+        painter->setPen(FAILED_MESSAGE_STATUS_COLOR);
+    }
+    painter->drawStaticText(QPointF(contentRect.right() + 1 - layout->time.size().width(), contentRect.top()),
+                            layout->time);
+    painter->setPen(option.palette.color(QPalette::WindowText));
+
+    painter->drawStaticText(contentRect.topLeft() + QPoint(0, option.fontMetrics.height() + HEADER_SPACING),
+                            layout->text);
 
     painter->restore();
-
-    auto font = painter->font();
-    QFontMetrics fontMetrics(font);
-    auto textRect = fontMetrics.boundingRect(styledOption.rect,
-                                             Qt::AlignLeft | Qt::TextWordWrap,
-                                             index.data(MessageDataRole::Text).toString());
-
-//    qDebug() << "text: " << index.data(MessageDataRole::Text).toString();
-//    qDebug() << "Styled option rect: " << styledOption.rect;
-//    qDebug() << "text bounding rect " << textRect;
 }
 
 QSize MessageItemDelegate::sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const
 {
-    QRect boundingRect(0, 0, width, 10);
-
+    TRACE_SCOPE("MessageItemDelegate::sizeHint");
+    auto bucketWidth = widthBucket(width);
+    auto messageId = index.data(MessageDataRole::Id).toString();
+    auto heightKey = (static_cast<quint64>(fontId(option.font)) << 32) | static_cast<quint32>(bucketWidth);
+
+    auto messageHeights = sizeHintCache.object(messageId);
+    if(messageHeights != nullptr){
+        auto height = messageHeights->heights.constFind(heightKey);
+        if(height != messageHeights->heights.constEnd()){
+            ++sizeHintCacheHits;
+            return QSize(width, height.value());
+        }
+    }
+    ++sizeHintCacheMisses;
+
+    QRect boundingRect(0, 0, textWidthForBucket(bucketWidth), 10);
 
-//    qDebug() << "width: " << width;
-//    qDebug() << "boundingRect: " << boundingRect;
-//    auto boundingRect = option.rect;
-//    boundingRect.translate(-boundingRect.x(), -boundingRect.y());
     auto text = index.data(MessageDataRole::Text).toString();
     auto textRect = option.fontMetrics.boundingRect(boundingRect,
                                                     Qt::AlignLeft | Qt::TextWordWrap,
                                                     text);
 
-    auto size = textRect.size();
-    size.setHeight(size.height() + HEADER_HEIGHT);
+    auto height = MESSAGE_MARGIN + 2 * MESSAGE_PADDING +
+                  option.fontMetrics.height() + HEADER_SPACING + textRect.height();
 
-//    qDebug() << "Computed size: " << size;
+    if(messageHeights == nullptr){
+        messageHeights = new MessageHeights();
+        sizeHintCache.insert(messageId, messageHeights);
+    }
+    messageHeights->heights.insert(heightKey, height);
 
-//    auto size = option.rect.size();
-//    size.setHeight(40);
-    return size;
+    return QSize(width, height);
 }
 
 void MessageItemDelegate::setWidth(const int width)
 {
-//    qDebug() << "setWidth() width: " << width;
     this->width = width;
 }
 
@@ -76,3 +117,91 @@ int MessageItemDelegate::getWidth() const
 {
     return width;
 }
+
+int MessageItemDelegate::widthBucket(const int width)
+{
+    return width - width % WIDTH_BUCKET;
+}
+
+void MessageItemDelegate::invalidateMessage(const QString &messageId)
+{
+    sizeHintCache.remove(messageId);
+    layoutCache.remove(messageId);
+}
+
+void MessageItemDelegate::clearCaches()
+{
+    sizeHintCache.clear();
+    layoutCache.clear();
+}
+
+void MessageItemDelegate::invalidateMessageLayout(const QString &messageId)
+{
+    layoutCache.remove(messageId);
+}
+
+void MessageItemDelegate::clearLayoutCache()
+{
+    layoutCache.clear();
+}
+
+quint64 MessageItemDelegate::getSizeHintCacheHits() const
+{
+    return sizeHintCacheHits;
+}
+
+quint64 MessageItemDelegate::getSizeHintCacheMisses() const
+{
+    return sizeHintCacheMisses;
+}
+
+int MessageItemDelegate::fontId(const QFont &font) const
+{
+    if(lastFontId >= 0 && font == lastFont){
+        return lastFontId;
+    }
+
+    auto fontKey = font.key();
+    auto id = fontIds.constFind(fontKey);
+    if(id == fontIds.constEnd()){
+        id = fontIds.insert(fontKey, fontIds.size());
+    }
+    lastFont = font;
+    lastFontId = id.value();
+    return lastFontId;
+}
+
+int MessageItemDelegate::textWidthForBucket(const int bucketWidth) const
+{
+    return std::max(bucketWidth - 2 * (MESSAGE_MARGIN + MESSAGE_PADDING), 1);
+}
+
+const MessageItemDelegate::MessageLayout *MessageItemDelegate::messageLayout(const QStyleOptionViewItem &option,
+                                                                             const QModelIndex &index) const
+{
+    auto bucketWidth = widthBucket(width);
+    auto layoutFontId = fontId(option.font);
+    auto messageId = index.data(MessageDataRole::Id).toString();
+
+    auto layout = layoutCache.object(messageId);
+    if(layout != nullptr && layout->widthBucket == bucketWidth && layout->fontId == layoutFontId){
+        return layout;
+    }
+
+    //Wrapped at the same width as used for the size hint, so the text fits the row
+    layout = new MessageLayout();
+    layout->widthBucket = bucketWidth;
+    layout->fontId = layoutFontId;
+    layout->username.setText(index.data(MessageDataRole::Username).toString());
+    layout->time.setText(index.data(MessageDataRole::TimeText).toString());
+    layout->text.setText(index.data(MessageDataRole::Text).toString());
+    layout->text.setTextWidth(textWidthForBucket(bucketWidth));
+    for(auto staticText : {&layout->username, &layout->time, &layout->text}){
+        staticText->setTextFormat(Qt::PlainText);
+        staticText->setPerformanceHint(QStaticText::AggressiveCaching);
+        staticText->prepare(QTransform(), option.font);
+    }
+
+    layoutCache.insert(messageId, layout);
+    return layout;
+}
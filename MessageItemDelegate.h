@@ -2,6 +2,10 @@
 #define MESSAGEDELEGATE_H
 
 #include <QStyledItemDelegate>
+#include <QCache>
+#include <QHash>
+#include <QFont>
+#include <QStaticText>
 
 class MessageItemDelegate : public QStyledItemDelegate
 {
@@ -17,8 +21,47 @@ public:
     void setWidth(const int width);
     int getWidth() const;
 
+    //Text is wrapped at the width rounded down to the bucket, so sizes are reused while resizing inside it
+    static int widthBucket(const int width);
+
+    void invalidateMessage(const QString& messageId);
+    void clearCaches();
+    //Heights don't depend on the time and status, changes of those only drop shaped texts
+    void invalidateMessageLayout(const QString& messageId);
+    void clearLayoutCache();
+
+    quint64 getSizeHintCacheHits() const;
+    quint64 getSizeHintCacheMisses() const;
+
 private:
+    //Heights of one message for each wrap width and font it was measured with
+    struct MessageHeights{
+        QHash<quint64, int> heights;
+    };
+
+    //Shaped texts of a message, valid for the width bucket and font they were prepared with
+    struct MessageLayout{
+        int widthBucket;
+        int fontId;
+        QStaticText username;
+        QStaticText time;
+        QStaticText text;
+    };
+
     int width;
+
+    mutable QCache<QString, MessageHeights> sizeHintCache;
+    mutable QCache<QString, MessageLayout> layoutCache;
+    mutable QHash<QString, int> fontIds;
+    mutable QFont lastFont;
+    mutable int lastFontId;
+
+    mutable quint64 sizeHintCacheHits;
+    mutable quint64 sizeHintCacheMisses;
+
+    int fontId(const QFont& font) const;
+    int textWidthForBucket(const int bucketWidth) const;
+    const MessageLayout* messageLayout(const QStyleOptionViewItem &option, const QModelIndex &index) const;
 };
 
 #endif // MESSAGEDELEGATE_H
@@ -1,8 +1,13 @@
 #include "MessageModel.h"
 
 #include <QJsonObject>
+#include <QDateTime>
+#include <QUuid>
 
 #include "MessageDataRole.h"
+#include "Trace.h"
+
+#include <algorithm>
 
 #include <QDebug>
 
@@ -11,15 +16,20 @@ const QString MESSAGE_TEXT_KEY = "Text";
 const QString MESSAGE_ID_KEY = "Id";
 const QString MESSAGE_POST_TIME_KEY = "Time";
 
+const QString DEFAULT_TIME_FORMAT = "dd.MM.yyyy hh:mm:ss";
+const int TIME_TEXT_CACHE_SIZE = 5000;
+
 MessageModel::MessageModel(QObject *parent) :
-    QAbstractListModel{parent}
+    QAbstractListModel{parent},
+    timeFormat(DEFAULT_TIME_FORMAT),
+    timeTexts(TIME_TEXT_CACHE_SIZE)
 {
 
 }
 
 int MessageModel::rowCount(const QModelIndex &parent) const
 {
-    return messages.size();
+    return store.size() + static_cast<int>(pendingMessages.size());
 }
 
 QVariant MessageModel::data(const QModelIndex &index, int role) const
@@ -29,31 +39,42 @@ QVariant MessageModel::data(const QModelIndex &index, int role) const
         return QVariant();
     }
 
-    if(index.row() >= messages.size()){
+    if(index.row() >= rowCount()){
         qWarning() << "Incorrect model index";
+        return QVariant();
+    }
+
+    if(index.row() >= store.size()){
+        return pendingMessageData(pendingMessages[index.row() - store.size()], role);
     }
 
     switch (role) {
         case MessageDataRole::Id:{
-            return messages.at(index.row()).id;
+            return store.id(index.row());
             break;
         }
         case MessageDataRole::Username:{
-            return messages.at(index.row()).username;
+            return store.username(index.row());
             break;
         }
         case MessageDataRole::Text:{
-            return messages.at(index.row()).text;
+            return store.text(index.row());
             break;
         }
         case MessageDataRole::Time:{
-            bool convertIsOk = false;
-            auto msecs = messages.at(index.row()).postTime.toLongLong(&convertIsOk);
-            if(!convertIsOk){
-                qDebug() << "Error converting QString value to quint64";
+            auto postTime = store.postTime(index.row());
+            if(postTime == MessageStore::INVALID_POST_TIME){
                 return QVariant();
             }
-            return QDateTime::fromMSecsSinceEpoch(msecs);
+            return QDateTime::fromMSecsSinceEpoch(postTime);
+            break;
+        }
+        case MessageDataRole::TimeText:{
+            return timeText(index.row());
+            break;
+        }
+        case MessageDataRole::Status:{
+            return static_cast<int>(MessageStatus::Confirmed);
             break;
         }
         default:
@@ -61,15 +82,337 @@ QVariant MessageModel::data(const QModelIndex &index, int role) const
     }
 }
 
-//TODO: Make only required changes in messages
-void MessageModel::setMessages(const std::vector<ChatMessageData> messages)
+void MessageModel::setMessages(const ChatHistory &messages)
+{
+    TRACE_SCOPE("MessageModel::setMessages");
+    if(messages == nullptr || messages->empty() || store.isEmpty()){
+        resetMessages(messages);
+        return;
+    }
+
+    QHash<QString, int> newPositions;
+    newPositions.reserve(messages->size());
+    for(int i = 0; i < static_cast<int>(messages->size()); ++i){
+        newPositions.insert(messages->at(i).id, i);
+    }
+    if(newPositions.size() != static_cast<int>(messages->size()) || !keepsMessagesOrder(newPositions)){
+        qDebug() << "Messages order changed, resetting model";
+        resetMessages(messages);
+        return;
+    }
+
+    removeMissingMessages(newPositions);
+
+    std::vector<const ChatMessageData*> receivedMessages;
+    for(auto& message : *messages){
+        if(!store.contains(message.id)){
+            receivedMessages.push_back(&message);
+        }
+    }
+    reconcilePendingMessages(receivedMessages);
+
+    //Remaining rows are in the order of new messages, so everything else is inserted between them
+    int row = 0;
+    int changedFirstRow = -1;
+    int changedLastRow = -1;
+    auto flushChangedRows = [this, &changedFirstRow, &changedLastRow](){
+        if(changedFirstRow >= 0){
+            emit dataChanged(index(changedFirstRow), index(changedLastRow));
+            changedFirstRow = changedLastRow = -1;
+        }
+    };
+    for(int newPosition = 0; newPosition < static_cast<int>(messages->size());){
+        const auto& message = messages->at(newPosition);
+        if(row < store.size() && store.id(row) == message.id){
+            if(!store.equals(row, message)){
+                if(changedLastRow != row - 1){
+                    flushChangedRows();
+                    changedFirstRow = row;
+                }
+                changedLastRow = row;
+                store.replace(row, message);
+            }
+            ++row;
+            ++newPosition;
+            continue;
+        }
+
+        flushChangedRows();
+        int insertCount = 1;
+        while(newPosition + insertCount < static_cast<int>(messages->size()) &&
+              (row >= store.size() ||
+               store.id(row) != messages->at(newPosition + insertCount).id)){
+            ++insertCount;
+        }
+
+        beginInsertRows(QModelIndex(), row, row + insertCount - 1);
+        store.insert(row, &message, insertCount);
+        endInsertRows();
+
+        row += insertCount;
+        newPosition += insertCount;
+    }
+    flushChangedRows();
+}
+
+void MessageModel::appendMessages(const ChatHistory &newMessages)
+{
+    TRACE_SCOPE("MessageModel::appendMessages");
+    if(newMessages == nullptr){
+        return;
+    }
+
+    //Overlapping updates may repeat already received messages
+    auto messagesToAppend = unknownMessages(newMessages);
+    if(messagesToAppend.empty()){
+        return;
+    }
+
+    reconcilePendingMessages(messagesToAppend);
+
+    int firstRow = store.size();
+    beginInsertRows(QModelIndex(), firstRow, firstRow + messagesToAppend.size() - 1);
+    store.insert(firstRow, messagesToAppend);
+    endInsertRows();
+}
+
+void MessageModel::prependMessages(const ChatHistory &olderMessages)
+{
+    TRACE_SCOPE("MessageModel::prependMessages");
+    if(olderMessages == nullptr){
+        return;
+    }
+
+    auto messagesToPrepend = unknownMessages(olderMessages);
+    if(messagesToPrepend.empty()){
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), 0, messagesToPrepend.size() - 1);
+    store.insert(0, messagesToPrepend);
+    endInsertRows();
+}
+
+void MessageModel::clear()
+{
+    pendingMessages.clear();
+    resetMessages(nullptr);
+}
+
+QString MessageModel::addPendingMessage(const QString &username, const QString &text, const quint64 requestId)
+{
+    PendingMessage message;
+    message.id = QUuid::createUuid().toString();
+    message.username = username;
+    message.text = text;
+    message.requestId = requestId;
+
+    int row = rowCount();
+    beginInsertRows(QModelIndex(), row, row);
+    pendingMessages.push_back(std::move(message));
+    endInsertRows();
+
+    return pendingMessages.back().id;
+}
+
+void MessageModel::confirmPendingMessage(const quint64 requestId, const QString &serverId)
+{
+    //Message stays pending until it arrives with chat updates, the server id only makes matching exact
+    auto row = pendingMessageRow(requestId);
+    if(row < 0 || serverId.isEmpty()){
+        return;
+    }
+    pendingMessages[row].serverId = serverId;
+}
+
+void MessageModel::failPendingMessage(const quint64 requestId)
+{
+    auto row = pendingMessageRow(requestId);
+    if(row < 0){
+        return;
+    }
+
+    pendingMessages[row].status = MessageStatus::Failed;
+    auto failedIndex = index(store.size() + row);
+    emit dataChanged(failedIndex, failedIndex, {MessageDataRole::Status, MessageDataRole::TimeText});
+}
+
+QString MessageModel::lastMessageId() const
+{
+    if(store.isEmpty()){
+        return QString();
+    }
+    return store.id(store.size() - 1);
+}
+
+QString MessageModel::oldestMessageId() const
+{
+    if(store.isEmpty()){
+        return QString();
+    }
+    return store.id(0);
+}
+
+void MessageModel::setTimeFormat(const QString &format, const QLocale &locale)
+{
+    if(format == timeFormat && locale == timeLocale){
+        return;
+    }
+    timeFormat = format;
+    timeLocale = locale;
+
+    //Cached texts of all rows become stale at once
+    timeTexts.clear();
+    if(!store.isEmpty()){
+        emit dataChanged(index(0), index(store.size() - 1), {MessageDataRole::TimeText});
+    }
+}
+
+const MessageStore &MessageModel::getStore() const
+{
+    return store;
+}
+
+QString MessageModel::timeText(const int row) const
+{
+    auto postTime = store.postTime(row);
+    if(postTime == MessageStore::INVALID_POST_TIME){
+        return QString();
+    }
+
+    auto cachedText = timeTexts.object(postTime);
+    if(cachedText != nullptr){
+        return *cachedText;
+    }
+
+    auto text = timeLocale.toString(QDateTime::fromMSecsSinceEpoch(postTime), timeFormat);
+    timeTexts.insert(postTime, new QString(text));
+    return text;
+}
+
+QVariant MessageModel::pendingMessageData(const PendingMessage &message, const int role) const
+{
+    switch (role) {
+        case MessageDataRole::Id:
+            return message.id;
+        case MessageDataRole::Username:
+            return message.username;
+        case MessageDataRole::Text:
+            return message.text;
+        case MessageDataRole::TimeText:
+            return message.status == MessageStatus::Failed ? tr("Not sent") : tr("Sending...");
+        case MessageDataRole::Status:
+            return static_cast<int>(message.status);
+        default:
+            return QVariant();
+    }
+}
+
+int MessageModel::pendingMessageRow(const quint64 requestId) const
 {
+    for(int row = 0; row < static_cast<int>(pendingMessages.size()); ++row){
+        if(pendingMessages[row].requestId == requestId){
+            return row;
+        }
+    }
+    return -1;
+}
+
+void MessageModel::reconcilePendingMessages(const std::vector<const ChatMessageData *> &receivedMessages)
+{
+    TRACE_SCOPE("MessageModel::reconcilePendingMessages");
+    if(pendingMessages.empty()){
+        return;
+    }
+
+    //Server id is matched exactly, otherwise the oldest own message with the same text is the sent one
+    for(auto receivedMessage : receivedMessages){
+        auto pendingMessage = std::find_if(pendingMessages.begin(), pendingMessages.end(),
+                                           [receivedMessage](const PendingMessage& message){
+            return message.serverId == receivedMessage->id;
+        });
+        if(pendingMessage == pendingMessages.end()){
+            pendingMessage = std::find_if(pendingMessages.begin(), pendingMessages.end(),
+                                          [receivedMessage](const PendingMessage& message){
+                return message.serverId.isEmpty() &&
+                       message.username == receivedMessage->username &&
+                       message.text == receivedMessage->text;
+            });
+        }
+        if(pendingMessage == pendingMessages.end()){
+            continue;
+        }
+
+        int row = store.size() + static_cast<int>(pendingMessage - pendingMessages.begin());
+        beginRemoveRows(QModelIndex(), row, row);
+        pendingMessages.erase(pendingMessage);
+        endRemoveRows();
+    }
+}
+
+void MessageModel::resetMessages(const ChatHistory &messages)
+{
+    TRACE_SCOPE("MessageModel::resetMessages");
+    if(messages != nullptr){
+        reconcilePendingMessages(unknownMessages(messages));
+    }
+
     beginResetModel();
-    this->messages = messages;
+    store.clear();
+    if(messages != nullptr){
+        store.reserve(messages->size());
+        store.insert(0, messages->data(), messages->size());
+    }
     endResetModel();
 }
 
-void MessageModel::wantsUpdate()
+bool MessageModel::keepsMessagesOrder(const QHash<QString, int> &newPositions) const
 {
-    emit layoutChanged();
+    int lastPosition = -1;
+    for(int row = 0; row < store.size(); ++row){
+        auto position = newPositions.value(store.id(row), -1);
+        if(position < 0){
+            continue;
+        }
+        if(position <= lastPosition){
+            return false;
+        }
+        lastPosition = position;
+    }
+    return true;
+}
+
+void MessageModel::removeMissingMessages(const QHash<QString, int> &newPositions)
+{
+    //Going from the end keeps indexes of not yet checked rows valid
+    int row = store.size() - 1;
+    while(row >= 0){
+        if(newPositions.contains(store.id(row))){
+            --row;
+            continue;
+        }
+
+        int lastRow = row;
+        while(row > 0 && !newPositions.contains(store.id(row - 1))){
+            --row;
+        }
+
+        beginRemoveRows(QModelIndex(), row, lastRow);
+        store.remove(row, lastRow);
+        endRemoveRows();
+
+        --row;
+    }
+}
+
+std::vector<const ChatMessageData *> MessageModel::unknownMessages(const ChatHistory &messages) const
+{
+    std::vector<const ChatMessageData*> result;
+    result.reserve(messages->size());
+    for(auto& message : *messages){
+        if(!store.contains(message.id)){
+            result.push_back(&message);
+        }
+    }
+    return result;
 }
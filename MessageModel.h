@@ -2,8 +2,13 @@
 #define MESSAGESMODEL_H
 
 #include <QAbstractListModel>
+#include <QHash>
+#include <QLocale>
+#include <QCache>
 
-#include "ChatMessageData.h"
+#include "ChatHistory.h"
+#include "MessageStore.h"
+#include "MessageStatus.h"
 
 #include <vector>
 
@@ -11,19 +16,57 @@ class MessageModel : public QAbstractListModel
 {
     Q_OBJECT
 
+    //Own message shown below the chat until it comes back from the server
+    struct PendingMessage{
+        QString id;
+        QString username;
+        QString text;
+        quint64 requestId = 0;
+        QString serverId;
+        MessageStatus status = MessageStatus::Pending;
+    };
+
 public:
     explicit MessageModel(QObject *parent = nullptr);
 
     virtual int rowCount(const QModelIndex &parent = QModelIndex()) const override;
     virtual QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
 
-    void setMessages(const std::vector<ChatMessageData> messages);
+    void setMessages(const ChatHistory& messages);
+    void appendMessages(const ChatHistory& newMessages);
+    void prependMessages(const ChatHistory& olderMessages);
+    void clear();
+
+    //Returns the local id of the added row
+    QString addPendingMessage(const QString& username, const QString& text, const quint64 requestId);
+    void confirmPendingMessage(const quint64 requestId, const QString& serverId);
+    void failPendingMessage(const quint64 requestId);
+
+    QString lastMessageId() const;
+    QString oldestMessageId() const;
 
-    void wantsUpdate();
+    void setTimeFormat(const QString& format, const QLocale& locale = QLocale());
 
+    const MessageStore& getStore() const;
 
 private:
-    std::vector<ChatMessageData> messages;
+    MessageStore store;
+    std::vector<PendingMessage> pendingMessages;
+
+    QString timeFormat;
+    QLocale timeLocale;
+    //Texts depend only on the post time, so rows posted at the same moment share them
+    mutable QCache<qint64, QString> timeTexts;
+
+    QString timeText(const int row) const;
+    QVariant pendingMessageData(const PendingMessage& message, const int role) const;
+    int pendingMessageRow(const quint64 requestId) const;
+    void reconcilePendingMessages(const std::vector<const ChatMessageData*>& receivedMessages);
+
+    void resetMessages(const ChatHistory& messages);
+    bool keepsMessagesOrder(const QHash<QString, int>& newPositions) const;
+    void removeMissingMessages(const QHash<QString, int>& newPositions);
+    std::vector<const ChatMessageData*> unknownMessages(const ChatHistory& messages) const;
 };
 
 #endif // MESSAGESMODEL_H
@@ -0,0 +1,11 @@
+#ifndef MESSAGESTATUS_H
+#define MESSAGESTATUS_H
+
+//Own messages are shown before the server confirms them
+enum class MessageStatus{
+    Confirmed,
+    Pending,
+    Failed
+};
+
+#endif // MESSAGESTATUS_H
@@ -0,0 +1,318 @@
+#include "MessageStore.h"
+
+#include "ChatMessageData.h"
+
+#include <QDebug>
+
+#include <limits>
+
+const qint64 MessageStore::INVALID_POST_TIME = std::numeric_limits<qint64>::min();
+
+MessageStore::MessageStore() :
+    unusedTextSize(0),
+    unusedIrregularIds(0)
+{
+
+}
+
+int MessageStore::size() const
+{
+    return ids.size();
+}
+
+bool MessageStore::isEmpty() const
+{
+    return ids.empty();
+}
+
+void MessageStore::clear()
+{
+    ids.clear();
+    idFormats.clear();
+    irregularIds.clear();
+    uuidIds.clear();
+    irregularIdSet.clear();
+    usernameIndexes.clear();
+    usernames.clear();
+    usernameIndexByName.clear();
+    postTimes.clear();
+    textArena.clear();
+    textOffsets.clear();
+    textLengths.clear();
+    unusedTextSize = 0;
+    unusedIrregularIds = 0;
+}
+
+void MessageStore::reserve(const int count)
+{
+    ids.reserve(count);
+    idFormats.reserve(count);
+    usernameIndexes.reserve(count);
+    postTimes.reserve(count);
+    textOffsets.reserve(count);
+    textLengths.reserve(count);
+}
+
+void MessageStore::append(const ChatMessageData &message)
+{
+    insert(size(), &message, 1);
+}
+
+void MessageStore::insert(const int row, const ChatMessageData *messages, const int count)
+{
+    insertEmptyRows(row, count);
+    for(int i = 0; i < count; ++i){
+        setRow(row + i, messages[i]);
+    }
+}
+
+void MessageStore::insert(const int row, const std::vector<const ChatMessageData *> &messages)
+{
+    auto count = static_cast<int>(messages.size());
+    insertEmptyRows(row, count);
+    for(int i = 0; i < count; ++i){
+        setRow(row + i, *messages.at(i));
+    }
+}
+
+void MessageStore::replace(const int row, const ChatMessageData &message)
+{
+    forgetId(row);
+    unusedTextSize += textLengths.at(row);
+    setRow(row, message);
+    compactTextArena();
+    compactIrregularIds();
+}
+
+void MessageStore::remove(const int firstRow, const int lastRow)
+{
+    for(int row = firstRow; row <= lastRow; ++row){
+        forgetId(row);
+        unusedTextSize += textLengths.at(row);
+    }
+
+    auto eraseRows = [firstRow, lastRow](auto& column){
+        column.erase(column.begin() + firstRow, column.begin() + lastRow + 1);
+    };
+    eraseRows(ids);
+    eraseRows(idFormats);
+    eraseRows(usernameIndexes);
+    eraseRows(postTimes);
+    eraseRows(textOffsets);
+    eraseRows(textLengths);
+
+    compactTextArena();
+    compactIrregularIds();
+}
+
+QString MessageStore::id(const int row) const
+{
+    switch (idFormats.at(row)) {
+        case IdFormat::Braces:
+            return ids.at(row).toString(QUuid::WithBraces);
+        case IdFormat::NoBraces:
+            return ids.at(row).toString(QUuid::WithoutBraces);
+        case IdFormat::Text:
+        default:
+            return irregularIds.at(ids.at(row).data1);
+    }
+}
+
+QString MessageStore::username(const int row) const
+{
+    return usernames.at(usernameIndexes.at(row));
+}
+
+QString MessageStore::text(const int row) const
+{
+    return textArena.mid(textOffsets.at(row), textLengths.at(row));
+}
+
+qint64 MessageStore::postTime(const int row) const
+{
+    return postTimes.at(row);
+}
+
+bool MessageStore::contains(const QString &id) const
+{
+    QUuid uuid;
+    if(parseId(id, uuid) != IdFormat::Text){
+        return uuidIds.contains(uuid);
+    }
+    return irregularIdSet.contains(id);
+}
+
+bool MessageStore::equals(const int row, const ChatMessageData &message) const
+{
+    return postTimes.at(row) == parsePostTime(message.postTime) &&
+           usernames.at(usernameIndexes.at(row)) == message.username &&
+           QStringView(textArena).mid(textOffsets.at(row), textLengths.at(row)) == message.text;
+}
+
+qsizetype MessageStore::memoryUsage() const
+{
+    //Hash buckets are counted with their node and a byte of span offset, which is close to what Qt allocates
+    auto hashUsage = [](const qsizetype buckets, const size_t nodeSize){
+        return buckets * static_cast<qsizetype>(nodeSize + 1);
+    };
+    //Strings are shared between the lists and the hashes, so their characters are counted once.
+    //Lists have no capacity in Qt 5, their size is close enough
+    auto stringsUsage = [](const QStringList& strings){
+        qsizetype usage = strings.size() * sizeof(QString);
+        for(const auto& string : strings){
+            usage += string.capacity() * sizeof(QChar);
+        }
+        return usage;
+    };
+
+    return ids.capacity() * sizeof(QUuid) +
+           idFormats.capacity() * sizeof(IdFormat) +
+           usernameIndexes.capacity() * sizeof(quint32) +
+           postTimes.capacity() * sizeof(qint64) +
+           textOffsets.capacity() * sizeof(quint32) +
+           textLengths.capacity() * sizeof(quint32) +
+           textArena.capacity() * sizeof(QChar) +
+           hashUsage(uuidIds.capacity(), sizeof(QUuid)) +
+           hashUsage(irregularIdSet.capacity(), sizeof(QString)) +
+           hashUsage(usernameIndexByName.capacity(), sizeof(QString) + sizeof(quint32)) +
+           stringsUsage(usernames) +
+           stringsUsage(irregularIds);
+}
+
+double MessageStore::bytesPerMessage() const
+{
+    if(isEmpty()){
+        return 0;
+    }
+    return static_cast<double>(memoryUsage()) / size();
+}
+
+void MessageStore::insertEmptyRows(const int row, const int count)
+{
+    ids.insert(ids.begin() + row, count, QUuid());
+    idFormats.insert(idFormats.begin() + row, count, IdFormat::Braces);
+    usernameIndexes.insert(usernameIndexes.begin() + row, count, 0);
+    postTimes.insert(postTimes.begin() + row, count, INVALID_POST_TIME);
+    textOffsets.insert(textOffsets.begin() + row, count, 0);
+    textLengths.insert(textLengths.begin() + row, count, 0);
+}
+
+void MessageStore::setRow(const int row, const ChatMessageData &message)
+{
+    storeId(row, message.id);
+    usernameIndexes[row] = internUsername(message.username);
+    postTimes[row] = parsePostTime(message.postTime);
+    storeText(row, message.text);
+}
+
+void MessageStore::storeId(const int row, const QString &id)
+{
+    QUuid uuid;
+    auto format = parseId(id, uuid);
+    if(format != IdFormat::Text){
+        ids[row] = uuid;
+        idFormats[row] = format;
+        uuidIds.insert(uuid);
+    }
+    else{
+        ids[row] = QUuid(irregularIds.size(), 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+        idFormats[row] = IdFormat::Text;
+        irregularIds.append(id);
+        irregularIdSet.insert(id);
+    }
+}
+
+void MessageStore::forgetId(const int row)
+{
+    if(idFormats.at(row) == IdFormat::Text){
+        irregularIdSet.remove(irregularIds.at(ids.at(row).data1));
+        ++unusedIrregularIds;
+    }
+    else{
+        uuidIds.remove(ids.at(row));
+    }
+}
+
+quint32 MessageStore::internUsername(const QString &username)
+{
+    auto index = usernameIndexByName.constFind(username);
+    if(index != usernameIndexByName.constEnd()){
+        return index.value();
+    }
+
+    quint32 newIndex = usernames.size();
+    usernames.append(username);
+    usernameIndexByName.insert(username, newIndex);
+    return newIndex;
+}
+
+void MessageStore::storeText(const int row, const QString &text)
+{
+    textOffsets[row] = textArena.size();
+    textLengths[row] = text.size();
+    textArena.append(text);
+}
+
+void MessageStore::compactTextArena()
+{
+    //Texts of removed and edited messages stay in the arena until they take more than half of it
+    if(unusedTextSize * 2 <= textArena.size()){
+        return;
+    }
+
+    QString compactedArena;
+    compactedArena.reserve(textArena.size() - unusedTextSize);
+    for(int row = 0; row < size(); ++row){
+        auto offset = compactedArena.size();
+        compactedArena.append(textArena.constData() + textOffsets.at(row), textLengths.at(row));
+        textOffsets[row] = offset;
+    }
+    textArena = std::move(compactedArena);
+    unusedTextSize = 0;
+}
+
+void MessageStore::compactIrregularIds()
+{
+    //Ids of removed rows are dropped the same way as their texts
+    if(unusedIrregularIds * 2 <= irregularIds.size()){
+        return;
+    }
+
+    QStringList compactedIds;
+    compactedIds.reserve(irregularIds.size() - unusedIrregularIds);
+    for(int row = 0; row < size(); ++row){
+        if(idFormats.at(row) == IdFormat::Text){
+            compactedIds.append(irregularIds.at(ids.at(row).data1));
+            ids[row].data1 = static_cast<uint>(compactedIds.size() - 1);
+        }
+    }
+    irregularIds = std::move(compactedIds);
+    unusedIrregularIds = 0;
+}
+
+MessageStore::IdFormat MessageStore::parseId(const QString &id, QUuid &uuid)
+{
+    //Only ids that are restored to exactly the same text are kept as binary UUIDs
+    uuid = QUuid(id);
+    if(uuid.isNull()){
+        return IdFormat::Text;
+    }
+    if(uuid.toString(QUuid::WithBraces) == id){
+        return IdFormat::Braces;
+    }
+    if(uuid.toString(QUuid::WithoutBraces) == id){
+        return IdFormat::NoBraces;
+    }
+    return IdFormat::Text;
+}
+
+qint64 MessageStore::parsePostTime(const QString &postTime)
+{
+    bool convertIsOk = false;
+    auto msecs = postTime.toLongLong(&convertIsOk);
+    if(!convertIsOk){
+        qDebug() << "Error converting QString value to quint64";
+        return INVALID_POST_TIME;
+    }
+    return msecs;
+}
@@ -0,0 +1,85 @@
+#ifndef MESSAGESTORE_H
+#define MESSAGESTORE_H
+
+#include <QString>
+#include <QStringList>
+#include <QUuid>
+#include <QHash>
+#include <QSet>
+
+#include <vector>
+
+struct ChatMessageData;
+
+//Column storage of chat messages: usernames are interned, ids and times are kept binary
+//and texts are packed one after another into a single string
+class MessageStore
+{
+public:
+    static const qint64 INVALID_POST_TIME;
+
+    MessageStore();
+
+    int size() const;
+    bool isEmpty() const;
+
+    void clear();
+    void reserve(const int count);
+
+    void append(const ChatMessageData& message);
+    void insert(const int row, const ChatMessageData* messages, const int count);
+    void insert(const int row, const std::vector<const ChatMessageData*>& messages);
+    void replace(const int row, const ChatMessageData& message);
+    void remove(const int firstRow, const int lastRow);
+
+    QString id(const int row) const;
+    QString username(const int row) const;
+    QString text(const int row) const;
+    qint64 postTime(const int row) const;
+
+    bool contains(const QString& id) const;
+    bool equals(const int row, const ChatMessageData& message) const;
+
+    qsizetype memoryUsage() const;
+    double bytesPerMessage() const;
+
+private:
+    enum class IdFormat : quint8{
+        Braces,
+        NoBraces,
+        Text
+    };
+
+    //Ids which are not UUIDs keep an index into irregularIds in data1 of their UUID slot
+    std::vector<QUuid> ids;
+    std::vector<IdFormat> idFormats;
+    QStringList irregularIds;
+    QSet<QUuid> uuidIds;
+    QSet<QString> irregularIdSet;
+
+    std::vector<quint32> usernameIndexes;
+    QStringList usernames;
+    QHash<QString, quint32> usernameIndexByName;
+
+    std::vector<qint64> postTimes;
+
+    QString textArena;
+    std::vector<quint32> textOffsets;
+    std::vector<quint32> textLengths;
+    qsizetype unusedTextSize;
+    qsizetype unusedIrregularIds;
+
+    void insertEmptyRows(const int row, const int count);
+    void setRow(const int row, const ChatMessageData& message);
+    void storeId(const int row, const QString& id);
+    void forgetId(const int row);
+    quint32 internUsername(const QString& username);
+    void storeText(const int row, const QString& text);
+    void compactTextArena();
+    void compactIrregularIds();
+
+    static IdFormat parseId(const QString& id, QUuid& uuid);
+    static qint64 parsePostTime(const QString& postTime);
+};
+
+#endif // MESSAGESTORE_H
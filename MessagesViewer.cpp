@@ -1,87 +1,153 @@
 #include "MessagesViewer.h"
 
-#include <MessageDataRole.h>
-#include <QHBoxLayout>
-#include <QVBoxLayout>
-#include <QDateTime>
+#include <QResizeEvent>
 #include <QScrollBar>
 
-#include "DependingWidthWidget.h"
-#include "MessageLabel.h"
+#include "MessageItemDelegate.h"
+#include "MessageDataRole.h"
+#include "Trace.h"
 
 #include <QDebug>
 
-const QString dateTimeFormat = "dd.MM.yyyy hh:mm:ss";
+#include <algorithm>
+
+const int LAYOUT_BATCH_SIZE = 100;
+const int DEFAULT_PREFETCH_DISTANCE = 10;
+//Roles shown without affecting the height of a message
+const QVector<int> HEIGHT_PRESERVING_ROLES = {MessageDataRole::TimeText, MessageDataRole::Status};
 
 MessagesViewer::MessagesViewer(QWidget *parent)
-    : QScrollArea{parent},
-      mainWidget(nullptr)
+    : QListView{parent},
+      messageItemDelegate(new MessageItemDelegate(this)),
+      prefetchDistance(DEFAULT_PREFETCH_DISTANCE),
+      scrollAnchorOffset(0)
 {
+    setItemDelegate(messageItemDelegate);
+
+    setVerticalScrollMode(QAbstractItemView::ScrollPerPixel);
+    setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    setSelectionMode(QAbstractItemView::NoSelection);
+    setEditTriggers(QAbstractItemView::NoEditTriggers);
+    setFocusPolicy(Qt::NoFocus);
+
+    setResizeMode(QListView::Adjust);
+    setLayoutMode(QListView::Batched);
+    setBatchSize(LAYOUT_BATCH_SIZE);
 
+    connect(verticalScrollBar(), &QScrollBar::valueChanged, this, &MessagesViewer::checkPrefetch);
 }
 
-void MessagesViewer::setDataFromModel(const QAbstractItemModel * const model)
-{    
-    auto oldMainwidget = takeWidget();
-    if(oldMainwidget != nullptr){
-        oldMainwidget->deleteLater();
+void MessagesViewer::setModel(QAbstractItemModel *model)
+{
+    if(this->model() != nullptr){
+        disconnect(this->model(), &QAbstractItemModel::rowsAboutToBeInserted,
+                   this, &MessagesViewer::onRowsAboutToBeInserted);
     }
-    verticalLabelsList.clear();
-
-    mainWidget = new QWidget();
-    mainWidget->setSizePolicy(QSizePolicy::Preferred, QSizePolicy::Maximum);
-    auto mainLayout = new QVBoxLayout(mainWidget);
-    mainLayout->setSizeConstraint(QLayout::SetMinimumSize);
-
-    for (int i = 0; i < model->rowCount() ; ++i) {
-        auto modelIndex = model->index(i, 0);
-
-//        auto messageWidget = new DependingWidthWidget();
-        auto messageWidget = new QWidget();
-        messageWidget->setObjectName("messageWidget");
-        messageWidget->setSizePolicy(QSizePolicy::Preferred, QSizePolicy::Maximum);
-        messageWidget->setStyleSheet("QWidget#messageWidget{"
-                                     "background-color: #E0E0E0;"
-                                     "border: 1px solid #AAAAAA;"
-                                     "border-radius: 5px;"
-                                     "}");
-        auto messageLayout = new QVBoxLayout();
-        messageWidget->setLayout(messageLayout);
-        messageLayout->setSizeConstraint(QLayout::SetMinimumSize);
-        auto messageHeaderLayout = new QHBoxLayout();
-
-        auto usernameLabel = new QLabel(modelIndex.data(MessageDataRole::Username).toString());
-        verticalLabelsList.push_back(usernameLabel);
-        auto messageDateTime = new QLabel(modelIndex.data(MessageDataRole::Time).toDateTime().toString(dateTimeFormat));
-        messageHeaderLayout->addWidget(usernameLabel);
-        messageHeaderLayout->addWidget(messageDateTime, 0, Qt::AlignRight);
-
-//        auto messageTextLabel = new MessageLabel(modelIndex.data(MessageDataRole::Text).toString());
-        auto messageTextLabel = new QLabel(modelIndex.data(MessageDataRole::Text).toString());
-        messageTextLabel->setSizePolicy(QSizePolicy::MinimumExpanding, QSizePolicy::Maximum);
-        messageTextLabel->setWordWrap(true);
-        verticalLabelsList.push_back(messageTextLabel);
-
-//        messageWidget->setWidthSourceWidget(messageTextLabel);
-
-        messageLayout->addLayout(messageHeaderLayout);
-        messageLayout->addWidget(messageTextLabel);
-//        mainLayout->addLayout(messageLayout);
-        mainLayout->addWidget(messageWidget);
+
+    QListView::setModel(model);
+
+    if(model != nullptr){
+        connect(model, &QAbstractItemModel::rowsAboutToBeInserted,
+                this, &MessagesViewer::onRowsAboutToBeInserted);
     }
+}
 
-    setWidget(mainWidget);
+const MessageItemDelegate *MessagesViewer::getMessageItemDelegate() const
+{
+    return messageItemDelegate;
+}
+
+void MessagesViewer::setPrefetchDistance(const int rows)
+{
+    prefetchDistance = rows;
 }
 
 void MessagesViewer::resizeEvent(QResizeEvent *event)
 {
-    QScrollArea::resizeEvent(event);
+    TRACE_SCOPE("MessagesViewer::resizeEvent");
+    //Size hints depend on the width, relayout is scheduled by the list view itself
+    //and reuses cached sizes while the width stays in the same bucket
+    messageItemDelegate->setWidth(viewport()->width());
+
+    QListView::resizeEvent(event);
+}
+
+void MessagesViewer::paintEvent(QPaintEvent *event)
+{
+    //Only here to trace painting of the visible rows
+    TRACE_SCOPE("MessagesViewer::paintEvent");
+    QListView::paintEvent(event);
+}
+
+void MessagesViewer::dataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QVector<int> &roles)
+{
+    TRACE_SCOPE("MessagesViewer::dataChanged");
+    //Unknown roles may change anything, so only listed ones are taken as keeping heights
+    bool heightsKept = !roles.isEmpty() && std::all_of(roles.begin(), roles.end(), [](const int role){
+        return HEIGHT_PRESERVING_ROLES.contains(role);
+    });
+
+    if(heightsKept && topLeft.row() == 0 && bottomRight.row() == model()->rowCount() - 1){
+        messageItemDelegate->clearLayoutCache();
+    }
+    else{
+        for(int row = topLeft.row(); row <= bottomRight.row(); ++row){
+            auto messageId = model()->index(row, 0).data(MessageDataRole::Id).toString();
+            if(heightsKept){
+                messageItemDelegate->invalidateMessageLayout(messageId);
+            }
+            else{
+                messageItemDelegate->invalidateMessage(messageId);
+            }
+        }
+    }
+
+    //Rows keeping their heights are only repainted
+    QListView::dataChanged(topLeft, bottomRight, roles);
+    if(!heightsKept){
+        scheduleDelayedItemsLayout();
+    }
+}
+
+void MessagesViewer::rowsInserted(const QModelIndex &parent, int start, int end)
+{
+    TRACE_SCOPE("MessagesViewer::rowsInserted");
+    QListView::rowsInserted(parent, start, end);
+
+    //Rows prepended above keep the previously visible ones in place
+    if(scrollAnchorIndex.isValid()){
+        auto anchorIndex = scrollAnchorIndex;
+        scrollAnchorIndex = QPersistentModelIndex();
 
-    int verticalScrollBarWidth = 0;
-    if(verticalScrollBar()->isVisible()){
-        verticalScrollBarWidth = verticalScrollBar()->width();
+        executeDelayedItemsLayout();
+        auto scrollBar = verticalScrollBar();
+        scrollBar->setValue(scrollBar->value() + visualRect(anchorIndex).top() - scrollAnchorOffset);
     }
-    mainWidget->setFixedWidth(this->width() - verticalScrollBarWidth);
 
-    mainWidget->adjustSize();
+    checkPrefetch();
+}
+
+void MessagesViewer::onRowsAboutToBeInserted(const QModelIndex &parent, int start, int end)
+{
+    if(start != 0 || model()->rowCount(parent) == 0){
+        return;
+    }
+
+    auto topIndex = indexAt(QPoint(0, 0));
+    if(topIndex.isValid()){
+        scrollAnchorIndex = topIndex;
+        scrollAnchorOffset = visualRect(topIndex).top();
+    }
+}
+
+void MessagesViewer::checkPrefetch()
+{
+    if(model() == nullptr || model()->rowCount() == 0){
+        return;
+    }
+
+    auto topIndex = indexAt(QPoint(0, 0));
+    if(topIndex.isValid() && topIndex.row() < prefetchDistance){
+        emit olderMessagesRequested();
+    }
 }
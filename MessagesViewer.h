@@ -1,30 +1,47 @@
 #ifndef MESSAGESVIEWER_H
 #define MESSAGESVIEWER_H
 
-#include <QScrollArea>
+#include <QListView>
+#include <QPersistentModelIndex>
 
-#include <QAbstractItemModel>
-#include <QLabel>
+class MessageItemDelegate;
 
-#include <list>
-
-class MessagesViewer : public QScrollArea
+//Only visible messages are laid out and painted by the delegate, no widgets are created per message
+class MessagesViewer : public QListView
 {
     Q_OBJECT
 public:
     explicit MessagesViewer(QWidget *parent = nullptr);
 
-    void setDataFromModel(const QAbstractItemModel * const model);
+    virtual void setModel(QAbstractItemModel *model) override;
+
+    const MessageItemDelegate* getMessageItemDelegate() const;
+
+    //Older messages are requested when the top visible row is closer than this to the first one
+    void setPrefetchDistance(const int rows);
 
 signals:
+    void olderMessagesRequested();
 
 protected:
     virtual void resizeEvent(QResizeEvent *event) override;
+    virtual void paintEvent(QPaintEvent *event) override;
+
+protected slots:
+    virtual void dataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight,
+                             const QVector<int> &roles = QVector<int>()) override;
+    virtual void rowsInserted(const QModelIndex &parent, int start, int end) override;
 
 private:
-    QWidget* mainWidget;
+    MessageItemDelegate* messageItemDelegate;
+
+    int prefetchDistance;
+
+    QPersistentModelIndex scrollAnchorIndex;
+    int scrollAnchorOffset;
 
-    std::list<QLabel*> verticalLabelsList;
+    void onRowsAboutToBeInserted(const QModelIndex &parent, int start, int end);
+    void checkPrefetch();
 };
 
 #endif // MESSAGESVIEWER_H
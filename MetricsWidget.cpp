@@ -0,0 +1,85 @@
+#include "MetricsWidget.h"
+
+#include <QVBoxLayout>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QFontDatabase>
+#include <QScrollBar>
+
+#include "TcpClient.h"
+#include "MessageModel.h"
+
+const int REFRESH_INTERVAL = 1000;
+
+MetricsWidget::MetricsWidget(TcpClient *tcpClient, const MessageModel *messageModel, QWidget *parent)
+    : QWidget{parent},
+    tcpClient(tcpClient),
+    messageModel(messageModel),
+    metricsView(new QPlainTextEdit()),
+    hasLastSnapshot(false)
+{
+    setWindowTitle(tr("Client metrics"));
+    resize(420, 600);
+
+    auto widgetLayout = new QVBoxLayout(this);
+
+    metricsView->setReadOnly(true);
+    metricsView->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    widgetLayout->addWidget(metricsView);
+
+    connect(&refreshTimer, &QTimer::timeout, this, &MetricsWidget::refresh);
+}
+
+void MetricsWidget::showEvent(QShowEvent *event)
+{
+    QWidget::showEvent(event);
+
+    hasLastSnapshot = false;
+    refresh();
+    refreshTimer.start(REFRESH_INTERVAL);
+}
+
+void MetricsWidget::hideEvent(QHideEvent *event)
+{
+    QWidget::hideEvent(event);
+
+    refreshTimer.stop();
+}
+
+void MetricsWidget::refresh()
+{
+    auto snapshot = tcpClient->metricsSnapshot();
+    auto metrics = snapshot.toJson();
+
+    //Rates are counted between two refreshes, so the first one has none
+    if(hasLastSnapshot && snapshot.uptime > lastSnapshot.uptime){
+        double seconds = (snapshot.uptime - lastSnapshot.uptime) / 1000.0;
+        auto rate = [seconds](const quint64 current, const quint64 last){
+            return (current - last) / seconds;
+        };
+
+        QJsonObject rates;
+        rates["bytesSent"] = rate(snapshot.bytesSent, lastSnapshot.bytesSent);
+        rates["bytesReceived"] = rate(snapshot.bytesReceived, lastSnapshot.bytesReceived);
+        rates["framesSent"] = rate(snapshot.framesSent, lastSnapshot.framesSent);
+        rates["framesReceived"] = rate(snapshot.framesReceived, lastSnapshot.framesReceived);
+        rates["notifications"] = rate(snapshot.notifications, lastSnapshot.notifications);
+        metrics["recentPerSecond"] = rates;
+    }
+
+    lastSnapshot = snapshot;
+    hasLastSnapshot = true;
+
+    //Measured only while the panel is shown, counting goes through every username and irregular id
+    const auto& store = messageModel->getStore();
+    metrics["messageStore"] = QJsonObject{
+        {"messages", store.size()},
+        {"memoryBytes", static_cast<qint64>(store.memoryUsage())},
+        {"bytesPerMessage", store.bytesPerMessage()}
+    };
+
+    //Keeps the scroll position while the text is replaced
+    auto scrollValue = metricsView->verticalScrollBar()->value();
+    metricsView->setPlainText(QJsonDocument(metrics).toJson(QJsonDocument::Indented));
+    metricsView->verticalScrollBar()->setValue(scrollValue);
+}
@@ -0,0 +1,38 @@
+#ifndef METRICSWIDGET_H
+#define METRICSWIDGET_H
+
+#include <QWidget>
+
+#include <QPlainTextEdit>
+#include <QTimer>
+
+#include "ClientMetrics.h"
+
+class TcpClient;
+class MessageModel;
+
+//Debug panel with the client metrics, refreshed only while it is shown
+class MetricsWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit MetricsWidget(TcpClient* tcpClient, const MessageModel* messageModel, QWidget *parent = nullptr);
+
+private:
+    TcpClient* tcpClient;
+    const MessageModel* messageModel;
+    QPlainTextEdit* metricsView;
+    QTimer refreshTimer;
+
+    ClientMetricsSnapshot lastSnapshot;
+    bool hasLastSnapshot;
+
+    virtual void showEvent(QShowEvent *event) override;
+    virtual void hideEvent(QHideEvent *event) override;
+
+private slots:
+    void refresh();
+};
+
+#endif // METRICSWIDGET_H
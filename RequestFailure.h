@@ -0,0 +1,16 @@
+#ifndef REQUESTFAILURE_H
+#define REQUESTFAILURE_H
+
+#include <QMetaType>
+
+//Why a request identified by its id got no successful response
+enum class RequestFailure{
+    Timeout,
+    Cancelled,
+    Disconnected,
+    Rejected
+};
+
+Q_DECLARE_METATYPE(RequestFailure)
+
+#endif // REQUESTFAILURE_H
@@ -3,6 +3,7 @@
 #include <QHostAddress>
 
 #include "TcpClientWorker.h"
+#include "Trace.h"
 
 #include "NewChatMessageData.h"
 
@@ -13,90 +14,203 @@ TcpClient::TcpClient(QObject *parent)
     : QObject{parent},
     workerThread(nullptr),
     worker(nullptr),
+    metrics(std::make_shared<ClientMetrics>()),
     started(false),
     restarting(false)
 {
+    connect(&metricsDumpTimer, &QTimer::timeout, this, &TcpClient::dumpMetrics);
+
     qRegisterMetaType<NewChatMessageData>();
+    qRegisterMetaType<ChatHistory>();
+    qRegisterMetaType<RequestFailure>();
 }
 
 TcpClient::~TcpClient()
 {
-
+    //Normally the thread has already finished after stopped was emitted
+    if(workerThread != nullptr){
+        workerThread->quit();
+        workerThread->wait();
+    }
 }
 
-void TcpClient::addGetChatRequest(const QUuid &sessionId) const
+quint64 TcpClient::addGetChatRequest(const QUuid &sessionId) const
 {
     if(!started){
         qCritical() << "Client is not started!";
-        return;
+        return 0;
     }
 
+    auto requestId = TcpClientWorker::newRequestId();
     QMetaObject::invokeMethod(worker,
                               "addGetChatRequest",
                               Qt::QueuedConnection,
+                              Q_ARG(quint64, requestId),
                               Q_ARG(QUuid, sessionId));
+
+    return requestId;
+}
+
+quint64 TcpClient::addGetChatUpdatesRequest(const QUuid &sessionId, const QString &lastKnownMessageId) const
+{
+    if(!started){
+        qCritical() << "Client is not started!";
+        return 0;
+    }
+
+    auto requestId = TcpClientWorker::newRequestId();
+    QMetaObject::invokeMethod(worker,
+                              "addGetChatUpdatesRequest",
+                              Qt::QueuedConnection,
+                              Q_ARG(quint64, requestId),
+                              Q_ARG(QUuid, sessionId),
+                              Q_ARG(QString, lastKnownMessageId));
+
+    return requestId;
+}
+
+quint64 TcpClient::addGetChatPageRequest(const QUuid &sessionId, const QString &beforeMessageId, const int pageSize) const
+{
+    if(!started){
+        qCritical() << "Client is not started!";
+        return 0;
+    }
+
+    auto requestId = TcpClientWorker::newRequestId();
+    QMetaObject::invokeMethod(worker,
+                              "addGetChatPageRequest",
+                              Qt::QueuedConnection,
+                              Q_ARG(quint64, requestId),
+                              Q_ARG(QUuid, sessionId),
+                              Q_ARG(QString, beforeMessageId),
+                              Q_ARG(int, pageSize));
+
+    return requestId;
 }
 
-void TcpClient::addSendChatMessageRequest(const QUuid &sessionId, const NewChatMessageData &message) const
+quint64 TcpClient::addSendChatMessageRequest(const QUuid &sessionId, const NewChatMessageData &message) const
 {
     if(!started){
         qWarning() << "Client was not started!";
-        return;
+        return 0;
     }
 
+    auto requestId = TcpClientWorker::newRequestId();
     QMetaObject::invokeMethod(worker,
                               "addSendChatMessageRequest",
                               Qt::QueuedConnection,
+                              Q_ARG(quint64, requestId),
                               Q_ARG(QUuid, sessionId),
                               Q_ARG(NewChatMessageData, message));
+
+    return requestId;
 }
 
-void TcpClient::confirmSession(const QUuid &userId, const QUuid &sessionId)
+quint64 TcpClient::confirmSession(const QUuid &userId, const QUuid &sessionId)
 {
     if(!started){
         qWarning() << "Client was not started!";
-        return;
+        return 0;
     }
 
+    auto requestId = TcpClientWorker::newRequestId();
     QMetaObject::invokeMethod(worker,
                               "confirmSessionRequest",
                               Qt::QueuedConnection,
+                              Q_ARG(quint64, requestId),
                               Q_ARG(QUuid, userId),
                               Q_ARG(QUuid, sessionId));
+
+    return requestId;
 }
 
-void TcpClient::initSession(const QUuid &userId, const QString &username)
+quint64 TcpClient::initSession(const QUuid &userId, const QString &username)
 {
     if(!started){
         qWarning() << "Client was not started!";
-        return;
+        return 0;
     }
 
+    auto requestId = TcpClientWorker::newRequestId();
     QMetaObject::invokeMethod(worker,
                               "requestNewSessionRequest",
                               Qt::QueuedConnection,
+                              Q_ARG(quint64, requestId),
                               Q_ARG(QUuid, userId),
                               Q_ARG(QString, username));
+
+    return requestId;
+}
+
+quint64 TcpClient::resumeSession(const QUuid &userId, const QString &username,
+                                 const QUuid &sessionId, const QString &lastKnownMessageId)
+{
+    if(!started){
+        qWarning() << "Client was not started!";
+        return 0;
+    }
+
+    auto requestId = TcpClientWorker::newRequestId();
+    QMetaObject::invokeMethod(worker,
+                              "resumeSessionRequest",
+                              Qt::QueuedConnection,
+                              Q_ARG(quint64, requestId),
+                              Q_ARG(QUuid, userId),
+                              Q_ARG(QString, username),
+                              Q_ARG(QUuid, sessionId),
+                              Q_ARG(QString, lastKnownMessageId));
+
+    return requestId;
+}
+
+void TcpClient::cancelRequest(const quint64 requestId) const
+{
+    if(!started){
+        qWarning() << "Client was not started!";
+        return;
+    }
+
+    QMetaObject::invokeMethod(worker,
+                              "cancelRequest",
+                              Qt::QueuedConnection,
+                              Q_ARG(quint64, requestId));
 }
 
 void TcpClient::start(const QString &host, const quint16 port)
 {
+    TRACE_SCOPE("TcpClient::start");
     started = true;
 
     workerThread = new QThread(this);
-    worker = new TcpClientWorker();
+    //Threads are told apart by name in traces
+    workerThread->setObjectName("TcpClientWorker");
+    worker = new TcpClientWorker(options, metrics);
 
     worker->moveToThread(workerThread);
+    connect(workerThread, &QThread::finished, worker, &QObject::deleteLater);
+    connect(workerThread, &QThread::finished, this, &TcpClient::onWorkerThreadFinished);
     connect(worker, &TcpClientWorker::newSessionInitiated,
             this, &TcpClient::newSessionInitiated, Qt::QueuedConnection);
+    connect(worker, &TcpClientWorker::sessionResumed,
+            this, &TcpClient::sessionResumed, Qt::QueuedConnection);
+    connect(worker, &TcpClientWorker::sessionReady,
+            this, &TcpClient::sessionReady, Qt::QueuedConnection);
     connect(worker, &TcpClientWorker::chatHistoryReceived,
             this, &TcpClient::chatHistoryReceived, Qt::QueuedConnection);
+    connect(worker, &TcpClientWorker::newChatMessagesReceived,
+            this, &TcpClient::newChatMessagesReceived, Qt::QueuedConnection);
+    connect(worker, &TcpClientWorker::chatHistoryPageReceived,
+            this, &TcpClient::chatHistoryPageReceived, Qt::QueuedConnection);
     connect(worker, &TcpClientWorker::chatMessageSentSuccess,
             this, &TcpClient::chatMessageSentSuccess, Qt::QueuedConnection);
     connect(worker, &TcpClientWorker::startedSucessfully,
             this, &TcpClient::startedSuccessfully, Qt::QueuedConnection);
     connect(worker, &TcpClientWorker::stopped,
             this, &TcpClient::onWorkerStopped, Qt::QueuedConnection);
+    connect(worker, &TcpClientWorker::connectionLost,
+            this, &TcpClient::connectionLost, Qt::QueuedConnection);
+    connect(worker, &TcpClientWorker::requestFailed,
+            this, &TcpClient::requestFailed, Qt::QueuedConnection);
     connect(worker, &TcpClientWorker::chatHasBeenUpdated,
             this, &TcpClient::chatHasBeenUpdated, Qt::QueuedConnection);
 
@@ -113,15 +227,18 @@ void TcpClient::start(const QString &host, const quint16 port)
 
 void TcpClient::stop()
 {
+    TRACE_SCOPE("TcpClient::stop");
     if(!started){
         qWarning() << "TcpClient was not started";
         return;
     }
 
+    if(!stopDuration.isValid()){
+        stopDuration.start();
+    }
     QMetaObject::invokeMethod(worker,
                               &TcpClientWorker::stop,
                               Qt::QueuedConnection);
-
 }
 
 void TcpClient::restart(const QString &host, const quint16 port)
@@ -137,6 +254,30 @@ bool TcpClient::isStarted() const
     return started;
 }
 
+void TcpClient::setOptions(const TcpClientOptions &options)
+{
+    //Applied on the next start, except the metrics dump
+    this->options = options;
+
+    if(options.metricsDumpFile.isEmpty() || options.metricsDumpInterval <= 0){
+        metricsDumpTimer.stop();
+    }
+    else{
+        metricsDumpTimer.start(options.metricsDumpInterval);
+    }
+}
+
+ClientMetricsSnapshot TcpClient::metricsSnapshot() const
+{
+    return metrics->snapshot();
+}
+
+void TcpClient::dumpMetrics()
+{
+    TRACE_SCOPE("TcpClient::dumpMetrics");
+    ClientMetrics::saveSnapshot(metrics->snapshot(), options.metricsDumpFile);
+}
+
 void TcpClient::onWorkerStopped()
 {
     qDebug() << "onWorkerStopped()";
@@ -145,13 +286,23 @@ void TcpClient::onWorkerStopped()
         qCritical() << "Client was not started";
         return;
     }
-    started = false;
 
+    //Worker is deleted in its thread once it finishes, GUI thread doesn't wait for it
     workerThread->quit();
-    workerThread->wait();
+}
 
-    worker->deleteLater();
+void TcpClient::onWorkerThreadFinished()
+{
+    TRACE_SCOPE("TcpClient::onWorkerThreadFinished");
+    started = false;
     workerThread->deleteLater();
+    workerThread = nullptr;
+    worker = nullptr;
+
+    if(stopDuration.isValid()){
+        qDebug() << "Client stopped in " << stopDuration.elapsed() << " ms";
+        stopDuration.invalidate();
+    }
 
     if(!restarting){
         emit stopped();
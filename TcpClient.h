@@ -6,10 +6,17 @@
 #include <QTcpSocket>
 #include <QThread>
 #include <QUuid>
+#include <QElapsedTimer>
+#include <QTimer>
 
 #include "ChatMessageData.h"
+#include "ChatHistory.h"
+#include "TcpClientOptions.h"
+#include "RequestFailure.h"
+#include "ClientMetrics.h"
 
 #include <vector>
+#include <memory>
 
 class TcpClientWorker;
 
@@ -22,12 +29,19 @@ public:
     explicit TcpClient(QObject *parent = nullptr);
     ~TcpClient();
 
-    void addGetChatRequest(const QUuid& sessionId) const;
-    void addSendChatMessageRequest(const QUuid& sessionId,
-                                   const NewChatMessageData &message) const;
+    //Requests return their id, which is reported back by requestFailed, or 0 if client is not started
+    quint64 addGetChatRequest(const QUuid& sessionId) const;
+    quint64 addGetChatUpdatesRequest(const QUuid& sessionId, const QString& lastKnownMessageId) const;
+    quint64 addGetChatPageRequest(const QUuid& sessionId, const QString& beforeMessageId, const int pageSize) const;
+    quint64 addSendChatMessageRequest(const QUuid& sessionId,
+                                      const NewChatMessageData &message) const;
 
-    void initSession(const QUuid& userId, const QString& username);
-    void confirmSession(const QUuid& userId, const QUuid& sessionId);
+    quint64 initSession(const QUuid& userId, const QString& username);
+    quint64 confirmSession(const QUuid& userId, const QUuid& sessionId);
+    quint64 resumeSession(const QUuid& userId, const QString& username,
+                          const QUuid& sessionId, const QString& lastKnownMessageId);
+
+    void cancelRequest(const quint64 requestId) const;
 
     void start(const QString& host, const quint16 port);
     void stop();
@@ -35,27 +49,47 @@ public:
 
     bool isStarted() const;
 
+    void setOptions(const TcpClientOptions& options);
+
+    //Metrics are kept for the whole life of the client, over restarts and reconnects
+    ClientMetricsSnapshot metricsSnapshot() const;
+
 signals:
     void startedSuccessfully();
     void stopped();
+    void connectionLost();
 
-    void chatHistoryReceived(const std::vector<ChatMessageData>& history);
-    void chatMessageSentSuccess();
+    void requestFailed(quint64 requestId, RequestFailure failure);
+
+    void chatHistoryReceived(const ChatHistory& history);
+    void newChatMessagesReceived(const ChatHistory& newMessages);
+    void chatHistoryPageReceived(const ChatHistory& page, const QString& beforeMessageId, bool hasOlderMessages);
+    void chatMessageSentSuccess(quint64 requestId, const QString& messageId);
     void chatHasBeenUpdated();
 
     void newSessionInitiated(bool initSuccess, const QUuid& userId, const QUuid& sessionId);
+    void sessionResumed(const QUuid& userId, const QUuid& sessionId);
+    void sessionReady(bool resumed, qint64 connectToReadyTime);
 
 private:
     QThread* workerThread;
     TcpClientWorker* worker;
 
+    TcpClientOptions options;
+    std::shared_ptr<ClientMetrics> metrics;
+    QTimer metricsDumpTimer;
+
     bool started;
     bool restarting;
     QString hostForRestart;
     quint16 portForRestart;
 
+    QElapsedTimer stopDuration;
+
 private slots:
     void onWorkerStopped();
+    void onWorkerThreadFinished();
+    void dumpMetrics();
 };
 
 #endif // TCPCLIENT_H
@@ -0,0 +1,42 @@
+#ifndef TCPCLIENTOPTIONS_H
+#define TCPCLIENTOPTIONS_H
+
+#include <QString>
+
+struct TcpClientOptions{
+    //How many requests may wait for their responses at the same time
+    int maxRequestsInFlight = 4;
+
+    //Time to wait for a response, history requests are sent again up to the retries count after it
+    int requestTimeout = 10000;
+    int requestRetries = 2;
+
+    //MessagesUpdated notifications arriving closer than the debounce interval
+    //are merged into one chat update, which is delayed no longer than max latency
+    int notificationDebounceInterval = 50;
+    int notificationMaxLatency = 250;
+
+    //Offer binary CBOR frames to the server, JSON is used if it doesn't accept them
+    bool useCborEncoding = true;
+
+    //Offer zlib compression of frames, smaller frames than the threshold are sent as they are
+    bool useCompression = true;
+    int compressionThreshold = 1024;
+
+    //Lost connection is restored with exponentially growing, randomized delays between attempts
+    int reconnectInitialDelay = 500;
+    int reconnectMaxDelay = 30000;
+
+    //Chat messages sent while offline wait for the next session, the oldest ones are dropped above the limit
+    int offlineQueueLimit = 100;
+
+    //Chat messages sent within the linger time are packed into one frame if server accepts batches
+    int chatMessageBatchSize = 50;
+    int chatMessageBatchLinger = 10;
+
+    //Metrics are written to the file periodically if it is set
+    QString metricsDumpFile;
+    int metricsDumpInterval = 10000;
+};
+
+#endif // TCPCLIENTOPTIONS_H
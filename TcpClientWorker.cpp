@@ -2,6 +2,8 @@
 
 #include <QHostAddress>
 #include <QJsonDocument>
+#include <QJsonArray>
+#include <QRandomGenerator>
 
 #include "MessageType.h"
 #include "MessageUtils.h"
@@ -19,24 +21,109 @@
 #include "TcpDataTransmitter.h"
 
 #include "ChatMessageData.h"
+#include "Trace.h"
+
+#include <algorithm>
 
 const QHostAddress defaultHost = QHostAddress::LocalHost;
 const quint16 defaultPort = 44000;
 
-const int REQUEST_TIMEOUT = 10000;
-const int DISCONNECT_TIMEOUT = 5000;
+const QString SINCE_MESSAGE_ID_KEY = "SinceMessageId";
+const QString REQUEST_ID_KEY = "RequestId";
+const QString FEATURES_KEY = "Features";
+const QString BEFORE_MESSAGE_ID_KEY = "BeforeMessageId";
+const QString PAGE_SIZE_KEY = "PageSize";
+const QString HAS_OLDER_MESSAGES_KEY = "HasOlderMessages";
+const QString RESUME_SESSION_ID_KEY = "ResumeSessionId";
+const QString LAST_MESSAGE_ID_KEY = "LastMessageId";
+const QString RESUMED_KEY = "Resumed";
+const QString SENT_MESSAGE_ID_KEY = "MessageId";
+const QString BATCH_KEY = "Batch";
+const QString BATCH_RESULTS_KEY = "Results";
+const QString BATCH_RESULT_SUCCESS_KEY = "Success";
+const QString MESSAGE_USERNAME_KEY = "Username";
+const QString MESSAGE_TEXT_KEY = "Text";
+
+const QString CBOR_ENCODING_FEATURE = "cbor";
+const QString RESUME_SESSION_FEATURE = "resume";
+const QString BATCH_FEATURE = "batch";
+const QString ZLIB_COMPRESSION_FEATURE = "zlib";
+
+const int DRAIN_TIMEOUT = 2000;
+const int DISCONNECT_TIMEOUT = 3000;
+
+std::atomic<quint64> TcpClientWorker::lastRequestId{0};
+
+MessageType responseTypeForRequest(const MessageType requestType){
+    switch (requestType) {
+        case MessageType::NewSessionRequest:
+            return MessageType::NewSessionResponse;
+        case MessageType::GetHistory:
+            return MessageType::GetHistoryResponse;
+        case MessageType::AddMessage:
+            return MessageType::AddMessageResponse;
+        default:
+            return requestType;
+    }
+}
 
-TcpClientWorker::TcpClientWorker(QObject *parent)
+TcpClientWorker::TcpClientWorker(const TcpClientOptions &options, std::shared_ptr<ClientMetrics> metrics,
+                                 QObject *parent)
     : QObject{parent},
-      currentRequest(nullptr),
+      options(options),
+      metrics(metrics != nullptr ? metrics : std::make_shared<ClientMetrics>()),
       workerSocket(nullptr),
-      inRequestProcessing(false),
-      connected(false)
+      serverSupportsResume(false),
+      serverSupportsBatch(false),
+      wireEncoding(WireEncoding::Json),
+      compressFrames(false),
+      pendingNotificationsCount(0),
+      mergedNotificationsCount(0),
+      mergedHistoryRequestsCount(0),
+      connected(false),
+      stopping(false),
+      closingConnection(false),
+      sessionConfirmed(false),
+      port(0),
+      reconnectAttempt(0),
+      measuringSessionSetup(false),
+      currentSessionResumed(false)
 {
+    if(this->options.maxRequestsInFlight < 1){
+        qWarning() << "Invalid requests in flight limit: " << this->options.maxRequestsInFlight;
+        this->options.maxRequestsInFlight = 1;
+    }
+
     requestTimer.setParent(this);
     requestTimer.setSingleShot(true);
-    requestTimer.setInterval(REQUEST_TIMEOUT);
-    connect(&requestTimer, &QTimer::timeout, this, &TcpClientWorker::finishRequest);
+    connect(&requestTimer, &QTimer::timeout, this, &TcpClientWorker::onRequestTimeout);
+
+    notificationDebounceTimer.setParent(this);
+    notificationDebounceTimer.setSingleShot(true);
+    notificationDebounceTimer.setInterval(this->options.notificationDebounceInterval);
+    connect(&notificationDebounceTimer, &QTimer::timeout, this, &TcpClientWorker::flushNotifications);
+
+    notificationLatencyTimer.setParent(this);
+    notificationLatencyTimer.setSingleShot(true);
+    notificationLatencyTimer.setInterval(this->options.notificationMaxLatency);
+    connect(&notificationLatencyTimer, &QTimer::timeout, this, &TcpClientWorker::flushNotifications);
+
+    reconnectTimer.setParent(this);
+    reconnectTimer.setSingleShot(true);
+    connect(&reconnectTimer, &QTimer::timeout, this, &TcpClientWorker::reconnect);
+
+    batchLingerTimer.setParent(this);
+    batchLingerTimer.setSingleShot(true);
+    connect(&batchLingerTimer, &QTimer::timeout, this, &TcpClientWorker::flushChatMessageBatch);
+
+    shutdownTimer.setParent(this);
+    shutdownTimer.setSingleShot(true);
+    connect(&shutdownTimer, &QTimer::timeout, this, &TcpClientWorker::onShutdownTimeout);
+}
+
+quint64 TcpClientWorker::newRequestId()
+{
+    return ++lastRequestId;
 }
 
 void TcpClientWorker::init()
@@ -46,24 +133,130 @@ void TcpClientWorker::init()
     connect(workerSocket.get(), &QTcpSocket::connected, this, &TcpClientWorker::onConnected);
     connect(workerSocket.get(), &QTcpSocket::disconnected, this, &TcpClientWorker::onDisconnected);
     connect(workerSocket.get(), &QTcpSocket::errorOccurred, this, &TcpClientWorker::onSocketErrorOccured);
+    connect(workerSocket.get(), &QTcpSocket::bytesWritten, this, &TcpClientWorker::onBytesWritten);
     connect(workerSocket.get(), &QTcpSocket::stateChanged,
             this, [this](QAbstractSocket::SocketState socketState){
                 qDebug() << "Worker socket state: " << socketState;
             });
 }
 
-void TcpClientWorker::addGetChatRequest(const QUuid &sessionId)
+void TcpClientWorker::addGetChatRequest(const quint64 requestId, const QUuid &sessionId)
 {
     Request request(std::make_shared<GetHistoryMessage>(sessionId));
-    requestQueue.push(std::move(request));
-    continueRequestProcessing();
+    request.id = requestId;
+    addHistoryRequest(std::move(request));
+}
+
+void TcpClientWorker::addGetChatUpdatesRequest(const quint64 requestId, const QUuid &sessionId,
+                                               const QString &lastKnownMessageId)
+{
+    Request request(std::make_shared<GetHistoryMessage>(sessionId));
+    request.id = requestId;
+    request.lastKnownMessageId = lastKnownMessageId;
+    addHistoryRequest(std::move(request));
+}
+
+void TcpClientWorker::addGetChatPageRequest(const quint64 requestId, const QUuid &sessionId,
+                                            const QString &beforeMessageId, const int pageSize)
+{
+    Request request(std::make_shared<GetHistoryMessage>(sessionId));
+    request.id = requestId;
+    request.beforeMessageId = beforeMessageId;
+    request.pageSize = pageSize;
+    //Newest pages are asked for on every update of an empty chat, so they are merged like other updates
+    if(beforeMessageId.isEmpty()){
+        addHistoryRequest(std::move(request));
+        return;
+    }
+    queueRequest(std::move(request));
 }
 
-void TcpClientWorker::addSendChatMessageRequest(const QUuid &sessionId, const NewChatMessageData& message)
+void TcpClientWorker::addSendChatMessageRequest(const quint64 requestId, const QUuid &sessionId,
+                                                const NewChatMessageData& message)
 {
     Request request(std::make_shared<AddMessageMessage>(sessionId, message));
-    requestQueue.push(std::move(request));
-    continueRequestProcessing();
+    request.id = requestId;
+    request.chatMessage = message;
+    if(!sessionConfirmed){
+        addOfflineRequest(std::move(request));
+        return;
+    }
+    addChatMessageRequest(std::move(request));
+}
+
+void TcpClientWorker::cancelRequest(const quint64 requestId)
+{
+    auto hasRequestId = [requestId](const Request& request){
+        return request.id == requestId;
+    };
+
+    for(auto requests : {&requestQueue, &offlineRequests, &chatMessageBatch, &requestsInFlight}){
+        for(auto& request : *requests){
+            if(!request.expired && cancelMergedRequest(request, requestId)){
+                emit requestFailed(requestId, RequestFailure::Cancelled);
+                return;
+            }
+        }
+    }
+
+    for(auto requests : {&requestQueue, &offlineRequests, &chatMessageBatch}){
+        auto request = std::find_if(requests->begin(), requests->end(), hasRequestId);
+        if(request != requests->end()){
+            requests->erase(request);
+            emit requestFailed(requestId, RequestFailure::Cancelled);
+            return;
+        }
+    }
+
+    auto hasEntryId = [requestId](const BatchEntry& batchEntry){
+        return batchEntry.id == requestId;
+    };
+
+    //Message of a not yet sent batch is taken out of it, the frame takes the base fields of the next one
+    for(auto request = requestQueue.begin(); request != requestQueue.end(); ++request){
+        auto& batch = request->batch;
+        auto entry = std::find_if(batch.begin(), batch.end(), hasEntryId);
+        if(entry == batch.end()){
+            continue;
+        }
+
+        batch.erase(entry);
+        if(batch.empty()){
+            requestQueue.erase(request);
+        }
+        else{
+            request->message = batch.front().message;
+        }
+        emit requestFailed(requestId, RequestFailure::Cancelled);
+        return;
+    }
+
+    //Sent request can't be taken back, only its response is ignored
+    auto request = std::find_if(requestsInFlight.begin(), requestsInFlight.end(), hasRequestId);
+    if(request != requestsInFlight.end() && !request->expired){
+        expireCancelledRequest(*request);
+        emit requestFailed(requestId, RequestFailure::Cancelled);
+        return;
+    }
+
+    //Same for a message of a sent batch, the whole response is ignored once all of them are cancelled
+    for(auto& sentRequest : requestsInFlight){
+        auto entry = std::find_if(sentRequest.batch.begin(), sentRequest.batch.end(), hasEntryId);
+        if(sentRequest.expired || entry == sentRequest.batch.end() || entry->cancelled){
+            continue;
+        }
+
+        entry->cancelled = true;
+        if(std::all_of(sentRequest.batch.begin(), sentRequest.batch.end(), [](const BatchEntry& batchEntry){
+            return batchEntry.cancelled;
+        })){
+            expireCancelledRequest(sentRequest);
+        }
+        emit requestFailed(requestId, RequestFailure::Cancelled);
+        return;
+    }
+
+    qDebug() << "Request " << requestId << " to cancel is not pending";
 }
 
 void TcpClientWorker::start(const QString &host, const quint16 port)
@@ -74,106 +267,182 @@ void TcpClientWorker::start(const QString &host, const quint16 port)
         return;
     }
 
+    this->host = host;
+    this->port = port;
+    stopping = false;
+    closingConnection = false;
+    reconnectAttempt = 0;
+    serverSupportsResume = false;
     workerSocket->connectToHost(host, port);
 }
 
 void TcpClientWorker::stop()
 {
     Q_ASSERT(workerSocket != nullptr);
-    if(workerSocket->state() == QTcpSocket::UnconnectedState){
-        qDebug() << "Worker was not started";
+    if(stopping){
+        qDebug() << "Worker is already stopping";
         return;
     }
-    workerSocket->disconnectFromHost();
-    if(workerSocket->state() == QAbstractSocket::UnconnectedState ||
-        workerSocket->waitForDisconnected(DISCONNECT_TIMEOUT)){
-        qDebug() << "Socket disconnected!";
+    stopping = true;
+    reconnectTimer.stop();
+    shutdownDuration.start();
+
+    if(!connected){
+        //Aborted connection attempt doesn't emit disconnected
+        workerSocket->abort();
+        finishStop();
+        return;
+    }
+
+    //Nothing blocks here: pending chat messages are written out first, then the
+    //connection is closed gracefully and aborted if any step takes too long
+    drainPendingMessages();
+    if(workerSocket->bytesToWrite() == 0){
+        closeConnection();
     }
     else{
-        qWarning() << "Socket disconnection error";
-        onSocketErrorOccured(workerSocket->error());
+        shutdownTimer.start(DRAIN_TIMEOUT);
     }
 }
 
-void TcpClientWorker::requestNewSessionRequest(const QUuid &userId, const QString &username)
+void TcpClientWorker::requestNewSessionRequest(const quint64 requestId, const QUuid &userId, const QString &username)
 {
     Request request(std::make_shared<NewSessionRequestMessage>(userId, username));
-    requestQueue.push(std::move(request));
-    continueRequestProcessing();
+    request.id = requestId;
+    queueRequest(std::move(request));
 }
 
-void TcpClientWorker::confirmSessionRequest(const QUuid &userId, const QUuid &sessionId)
+void TcpClientWorker::resumeSessionRequest(const quint64 requestId, const QUuid &userId, const QString &username,
+                                           const QUuid &sessionId, const QString &lastKnownMessageId)
+{
+    if(!serverSupportsResume || sessionId.isNull() || lastKnownMessageId.isEmpty()){
+        requestNewSessionRequest(requestId, userId, username);
+        return;
+    }
+
+    Request request(std::make_shared<NewSessionRequestMessage>(userId, username));
+    request.id = requestId;
+    request.resumeSessionId = sessionId;
+    request.lastKnownMessageId = lastKnownMessageId;
+    queueRequest(std::move(request));
+
+    //Chat updates are requested together with the resume, so one round trip is enough if it is accepted
+    Request updatesRequest(std::make_shared<GetHistoryMessage>(sessionId));
+    updatesRequest.id = newRequestId();
+    updatesRequest.lastKnownMessageId = lastKnownMessageId;
+    updatesRequest.dependsOnResume = true;
+    queueRequest(std::move(updatesRequest));
+}
+
+void TcpClientWorker::confirmSessionRequest(const quint64 requestId, const QUuid &userId, const QUuid &sessionId)
 {
     Request request(std::make_shared<NewSessionConfirmMessage>(userId, sessionId), false);
-    requestQueue.push(std::move(request));
-    continueRequestProcessing();
+    request.id = requestId;
+    setRequestPolicy(request);
+    requestQueue.push_back(std::move(request));
+    onSessionConfirmed(sessionId);
 }
 
 void TcpClientWorker::onReadyRead()
 {
+    TRACE_SCOPE("TcpClientWorker::onReadyRead");
     auto receivedData = TcpDataTransmitter::receiveData(*workerSocket.get());
 
-    bool currentRequestProcessed = false;
     for(auto& data : receivedData){
-        bool responseReceived = false;
-        processMessageData(data, responseReceived);
-        if(currentRequestProcessed == responseReceived == true){
-            qWarning() << "Inapropriate message received";
-        }
-        else if(responseReceived){
-            currentRequestProcessed = true;
-        }
+        metrics->recordFrameReceived(data.size());
+        processMessageData(data);
     }
 
-    if(currentRequestProcessed){
-        finishRequest();
-    }
+    continueRequestProcessing();
 }
 
 void TcpClientWorker::processTopRequest()//TODO: Process top request through event loop
 {
-    if(currentRequest.isValid()){
-        qWarning() << "Request is already in process!";
-        return;
-    }
+    TRACE_SCOPE("TcpClientWorker::processTopRequest");
+    auto request = std::move(requestQueue.front());
+    requestQueue.pop_front();
 
-    inRequestProcessing = true;
-    currentRequest = requestQueue.front();
-    qDebug() << "Type of message to send: " << messageTypeToString(currentRequest.message->getMessageType());
-    if(!TcpDataTransmitter::sendData(currentRequest.message->toJson().toJson(), *workerSocket.get())){
+    qDebug() << "Type of message to send: " << messageTypeToString(request.message->getMessageType())
+             << ", request id: " << request.id;
+    auto requestData = WireFormat::encodeMessage(requestToJson(request), wireEncoding);
+    if(compressFrames && requestData.size() >= options.compressionThreshold){
+        requestData = compressFrame(requestData);
+    }
+    if(!TcpDataTransmitter::sendData(requestData, *workerSocket.get())){
         qWarning() << "Chat request failed";
+        failRequest(request, RequestFailure::Disconnected);
         return;
     }
+    metrics->recordRequestSent(requestTypeName(request), requestData.size());
+    request.sentTimer.start();
+    request.traceSentTime = Trace::now();
 
-    if(currentRequest.waitForResponse){
-        requestTimer.start();
-    }
-    else{
-        finishRequest();
+    if(request.waitForResponse){
+        request.deadline.setRemainingTime(request.timeout);
+        requestsInFlight.push_back(std::move(request));
+        restartRequestTimer();
     }
 }
 
 void TcpClientWorker::processNotification(std::shared_ptr<NotificationMessage> notitification)
 {
-    if(notitification->getNotificationType() == NotificationType::MessagesUpdated){
+    metrics->recordNotification();
+    if(notitification->getNotificationType() != NotificationType::MessagesUpdated){
+        return;
+    }
+
+    if(options.notificationDebounceInterval <= 0){
         emit chatHasBeenUpdated();
+        return;
+    }
+
+    ++pendingNotificationsCount;
+    notificationDebounceTimer.start();
+    if(!notificationLatencyTimer.isActive()){
+        notificationLatencyTimer.start();
     }
 }
 
-void TcpClientWorker::processMessageData(const QByteArray &data, bool &responseReceived)
+void TcpClientWorker::flushNotifications()
 {
-    QJsonParseError jsonParseError;
-    auto document = QJsonDocument::fromJson(data, &jsonParseError);
-    if(document.isNull()){
-        qWarning() << "Response parse error: " << jsonParseError.errorString();
+    notificationDebounceTimer.stop();
+    notificationLatencyTimer.stop();
+    if(pendingNotificationsCount == 0){
         return;
     }
-    if(!document.isObject()){
-        qWarning() << "Response is not JSON object";
+
+    mergedNotificationsCount += pendingNotificationsCount - 1;
+    metrics->recordMergedNotifications(pendingNotificationsCount - 1);
+    qDebug() << "Chat updated," << pendingNotificationsCount << "notifications merged,"
+             << mergedNotificationsCount << "merged in total";
+    pendingNotificationsCount = 0;
+
+    emit chatHasBeenUpdated();
+}
+
+void TcpClientWorker::processMessageData(const QByteArray &data)
+{
+    TRACE_SCOPE("TcpClientWorker::processMessageData");
+    //Chat messages of history responses are decoded separately, the message is built from the rest
+    QByteArray decompressedData;
+    if(WireFormat::isCompressedFrame(data)){
+        decompressedData = decompressFrame(data);
+        if(decompressedData.isEmpty()){
+            qWarning() << "Damaged compressed frame of " << data.size() << " bytes";
+            return;
+        }
+    }
+    const auto& messageData = decompressedData.isEmpty() ? data : decompressedData;
+
+    QJsonObject responseObject;
+    std::vector<ChatMessageData> receivedHistory;
+    QString parseErrorString;
+    if(!WireFormat::decodeMessage(messageData, responseObject, receivedHistory, parseErrorString)){
+        qWarning() << "Response parse error: " << parseErrorString;
         return;
     }
 
-    auto message = MessageUtils::createMessageFromJson(document);
+    auto message = MessageUtils::createMessageFromJson(QJsonDocument(responseObject));
 
     auto messageType = message->getMessageType();
     qDebug() << "Received message type: " << messageTypeToString(messageType);
@@ -183,25 +452,45 @@ void TcpClientWorker::processMessageData(const QByteArray &data, bool &responseR
         processNotification(notificationMessage);
         return;
     }
-    else if(!inRequestProcessing){
+    else if(requestsInFlight.empty() && requestQueue.empty()){
         qWarning() << "No data to be expected";
         return;
     }
 
-    if(!currentRequest.isValid()){
-        qCritical() << "Current request is invalid";
+    Request request;
+    auto requestIterator = findRequestForResponse(messageType, responseObject);
+    if(requestIterator != requestsInFlight.end()){
+        request = std::move(*requestIterator);
+        requestsInFlight.erase(requestIterator);
+        restartRequestTimer();
+    }
+    else if(!takeQueuedRetry(responseObject, request)){
+        qWarning() << "Inapropriate message received";
+        return;
+    }
+
+    if(request.expired){
+        qDebug() << "Late response to expired request " << request.id << " is discarded";
+        return;
+    }
+    metrics->recordResponse(requestTypeName(request), request.sentTimer.elapsed());
+    if(Trace::isEnabled()){
+        Trace::addAsyncSpan("Request", request.id, request.traceSentTime, requestTypeName(request));
+    }
+    if(request.discardResponse){
+        qDebug() << "Response to request " << request.id << " of rejected session resume is discarded";
         return;
     }
 
-    auto currentRequestMessageType = currentRequest.message->getMessageType();
-    qDebug() << "Last sent message type: " << messageTypeToString(currentRequestMessageType);
+    qDebug() << "Response to request " << request.id
+             << " of type " << messageTypeToString(request.message->getMessageType());
     switch (messageType){
         case MessageType::NewSessionResponse:{
-            if(currentRequestMessageType != MessageType::NewSessionRequest){
-                qWarning() << "Invalid message type";
+            auto responseMessage = std::dynamic_pointer_cast<NewSessionResponseMessage>(message);
+            processNewSessionResponse(responseObject);
+            if(processResumeResponse(request, responseMessage, responseObject)){
                 break;
             }
-            auto responseMessage = std::dynamic_pointer_cast<NewSessionResponseMessage>(message);
 
             emit newSessionInitiated(responseMessage->getUsernameIsValid(),
                                      responseMessage->getUserId(),
@@ -209,80 +498,774 @@ void TcpClientWorker::processMessageData(const QByteArray &data, bool &responseR
             break;
         }
         case MessageType::GetHistoryResponse:{
-            if(currentRequestMessageType != MessageType::GetHistory){
-                qWarning() << "Invalid message type";
+            if(!receivedHistory.empty()){
+                processHistoryResponse(request, std::move(receivedHistory), responseObject);
                 break;
             }
 
             auto responseMessage = std::dynamic_pointer_cast<GetHistoryResponseMessage>(message);
-
-            emit chatHistoryReceived(responseMessage->getMessagesHistory());
+            processHistoryResponse(request, responseMessage->getMessagesHistory(), responseObject);
             break;
         }
         case MessageType::AddMessageResponse:{
-            if(currentRequestMessageType != MessageType::AddMessage){
-                qWarning() << "Invalid message type";
-                break;
-            }
-
             auto responseMessage = std::dynamic_pointer_cast<AddMessageResponseMessage>(message);
-            if(responseMessage->getResult() != Result::Success){
+            if(!request.batch.empty()){
+                processBatchResponse(request, responseMessage, responseObject);
+            }
+            else if(responseMessage->getResult() != Result::Success){
                 qWarning() << "Message sent failed";
+                emit requestFailed(request.id, RequestFailure::Rejected);
             }
             else{
-                emit chatMessageSentSuccess();
+                //Servers may tell the id given to the message, so it is matched exactly when it comes back
+                emit chatMessageSentSuccess(request.id, responseObject.value(SENT_MESSAGE_ID_KEY).toString());
             }
             break;
         }
         default:
             break;
     }
+}
+
+QByteArray TcpClientWorker::compressFrame(const QByteArray &data)
+{
+    QElapsedTimer compressionTimer;
+    compressionTimer.start();
+    auto compressedData = WireFormat::compressFrame(data);
+    //Frames which don't shrink go as they are, stats count only frames sent compressed
+    if(compressedData.size() >= data.size()){
+        return data;
+    }
+    metrics->recordCompression(true, data.size(), compressedData.size(), compressionTimer.nsecsElapsed());
+    return compressedData;
+}
+
+QByteArray TcpClientWorker::decompressFrame(const QByteArray &data)
+{
+    QElapsedTimer decompressionTimer;
+    decompressionTimer.start();
+    auto decompressedData = WireFormat::decompressFrame(data);
+    auto decompressionTime = decompressionTimer.nsecsElapsed();
+
+    if(!decompressedData.isEmpty()){
+        metrics->recordCompression(false, decompressedData.size(), data.size(), decompressionTime);
+        qDebug() << "Received frame decompressed from " << data.size() << " to " << decompressedData.size()
+                 << " bytes in " << decompressionTime / 1000 << " us";
+    }
+    return decompressedData;
+}
+
+void TcpClientWorker::logCompressionStats() const
+{
+    //Ratio is compressed size to original one, time is per frame. Frames which grew save negative bytes
+    auto snapshot = metrics->snapshot();
+    for(auto stats : {std::make_pair("Sent", &snapshot.compression),
+                      std::make_pair("Received", &snapshot.decompression)}){
+        if(stats.second->frames == 0){
+            continue;
+        }
+        qDebug() << stats.first << " compressed frames: " << stats.second->frames
+                 << ", ratio: " << static_cast<double>(stats.second->compressedBytes) / stats.second->originalBytes
+                 << ", bytes saved: " << static_cast<qint64>(stats.second->originalBytes) -
+                                         static_cast<qint64>(stats.second->compressedBytes)
+                 << ", time per frame: " << stats.second->time / 1000 / static_cast<qint64>(stats.second->frames)
+                 << " us";
+    }
+}
 
-    responseReceived = true;
+void TcpClientWorker::processBatchResponse(const Request &request,
+                                          std::shared_ptr<AddMessageResponseMessage> responseMessage,
+                                          const QJsonObject &responseObject)
+{
+    //Without separate results the result of the whole frame applies to every message
+    auto results = responseObject.value(BATCH_RESULTS_KEY).toArray();
+    bool batchSucceeded = responseMessage->getResult() == Result::Success;
+    for(int i = 0; i < static_cast<int>(request.batch.size()); ++i){
+        const auto& entry = request.batch[i];
+        if(entry.cancelled){
+            continue;
+        }
+        auto result = results.at(i).toObject();
+        bool succeeded = i < results.size() ? result.value(BATCH_RESULT_SUCCESS_KEY).toBool() : batchSucceeded;
+        if(succeeded){
+            emit chatMessageSentSuccess(entry.id, result.value(SENT_MESSAGE_ID_KEY).toString());
+        }
+        else{
+            qWarning() << "Message sent failed";
+            emit requestFailed(entry.id, RequestFailure::Rejected);
+        }
+    }
 }
 
-bool TcpClientWorker::isInRequestProcessing() const
+void TcpClientWorker::processNewSessionResponse(const QJsonObject &responseObject)
 {
-    return currentRequest.isValid();
+    //Older servers don't answer with features and keep talking JSON
+    serverFeatures.clear();
+    for(const auto& feature : responseObject.value(FEATURES_KEY).toArray()){
+        serverFeatures.insert(feature.toString());
+    }
+
+    serverSupportsResume = serverFeatures.contains(RESUME_SESSION_FEATURE);
+    serverSupportsBatch = serverFeatures.contains(BATCH_FEATURE);
+    compressFrames = options.useCompression && serverFeatures.contains(ZLIB_COMPRESSION_FEATURE);
+
+    if(options.useCborEncoding && serverFeatures.contains(CBOR_ENCODING_FEATURE)){
+        wireEncoding = WireEncoding::Cbor;
+    }
+    else{
+        wireEncoding = WireEncoding::Json;
+    }
+    qDebug() << "Server features: " << serverFeatures
+             << ", CBOR encoding: " << (wireEncoding == WireEncoding::Cbor)
+             << ", compression: " << compressFrames;
+}
+
+bool TcpClientWorker::processResumeResponse(const Request &request,
+                                            std::shared_ptr<NewSessionResponseMessage> responseMessage,
+                                            const QJsonObject &responseObject)
+{
+    if(request.resumeSessionId.isNull()){
+        return false;
+    }
+
+    if(responseObject.value(RESUMED_KEY).toBool() &&
+       responseMessage->getSessionId() == request.resumeSessionId){
+        qDebug() << "Session resumed: " << request.resumeSessionId;
+        currentSessionResumed = true;
+        onSessionConfirmed(request.resumeSessionId);
+        emit sessionResumed(responseMessage->getUserId(), request.resumeSessionId);
+        return true;
+    }
+
+    //Server started a new session, so the full handshake continues as usual
+    qDebug() << "Session resume rejected";
+    dropResumeRequests();
+    return false;
+}
+
+void TcpClientWorker::dropResumeRequests()
+{
+    requestQueue.erase(std::remove_if(requestQueue.begin(), requestQueue.end(),
+                                      [](const Request& request){
+        return request.dependsOnResume;
+    }), requestQueue.end());
+
+    for(auto& request : requestsInFlight){
+        if(request.dependsOnResume){
+            request.discardResponse = true;
+        }
+    }
+}
+
+void TcpClientWorker::reportSessionReady()
+{
+    if(!measuringSessionSetup || !sessionConfirmed){
+        return;
+    }
+    measuringSessionSetup = false;
+
+    auto connectToReadyTime = sessionSetupTimer.elapsed();
+    qDebug() << "Session ready in " << connectToReadyTime << " ms after connection,"
+             << (currentSessionResumed ? "resumed" : "full handshake");
+    metrics->recordTiming(currentSessionResumed ? "SessionResumed" : "SessionHandshake", connectToReadyTime);
+    emit sessionReady(currentSessionResumed, connectToReadyTime);
+}
+
+void TcpClientWorker::processHistoryResponse(const Request &request,
+                                             std::vector<ChatMessageData> history,
+                                             const QJsonObject &responseObject)
+{
+    TRACE_SCOPE("TcpClientWorker::processHistoryResponse");
+    reportSessionReady();
+
+    if(request.pageSize > 0){
+        processHistoryPageResponse(request, std::move(history), responseObject);
+        return;
+    }
+
+    const auto& lastKnownMessageId = request.lastKnownMessageId;
+    if(lastKnownMessageId.isEmpty()){
+        emit chatHistoryReceived(std::make_shared<const std::vector<ChatMessageData>>(std::move(history)));
+        return;
+    }
+
+    //Server supporting updates echoes the marker and sends only the new messages
+    if(responseObject.value(SINCE_MESSAGE_ID_KEY).toString() == lastKnownMessageId){
+        emit newChatMessagesReceived(std::make_shared<const std::vector<ChatMessageData>>(std::move(history)));
+        return;
+    }
+
+    //Older servers ignore the marker, so cut the new messages from the full history
+    auto lastKnownMessage = std::find_if(history.rbegin(), history.rend(),
+                                         [&lastKnownMessageId](const ChatMessageData& message){
+        return message.id == lastKnownMessageId;
+    });
+    if(lastKnownMessage == history.rend()){
+        qDebug() << "Last known message is not in history, replacing whole chat";
+        emit chatHistoryReceived(std::make_shared<const std::vector<ChatMessageData>>(std::move(history)));
+        return;
+    }
+
+    auto newMessages = std::make_shared<const std::vector<ChatMessageData>>(
+        std::make_move_iterator(lastKnownMessage.base()),
+        std::make_move_iterator(history.end()));
+    emit newChatMessagesReceived(newMessages);
+}
+
+void TcpClientWorker::processHistoryPageResponse(const Request &request,
+                                                 std::vector<ChatMessageData> history,
+                                                 const QJsonObject &responseObject)
+{
+    TRACE_SCOPE("TcpClientWorker::processHistoryPageResponse");
+    //Server supporting pages echoes the page size and sends only the page
+    if(responseObject.contains(PAGE_SIZE_KEY)){
+        bool hasOlderMessages = responseObject.value(HAS_OLDER_MESSAGES_KEY)
+                                    .toBool(static_cast<int>(history.size()) >= request.pageSize);
+        emit chatHistoryPageReceived(std::make_shared<const std::vector<ChatMessageData>>(std::move(history)),
+                                     request.beforeMessageId, hasOlderMessages);
+        return;
+    }
+
+    if(request.beforeMessageId.isEmpty()){
+        emit chatHistoryReceived(std::make_shared<const std::vector<ChatMessageData>>(std::move(history)));
+        return;
+    }
+
+    //Older servers send the full history, so the page is cut from it
+    auto pageEnd = std::find_if(history.begin(), history.end(),
+                                [&request](const ChatMessageData& message){
+        return message.id == request.beforeMessageId;
+    });
+    if(pageEnd == history.end()){
+        qDebug() << "Oldest message is not in history, replacing whole chat";
+        emit chatHistoryReceived(std::make_shared<const std::vector<ChatMessageData>>(std::move(history)));
+        return;
+    }
+
+    auto pageBegin = pageEnd - std::min<qsizetype>(pageEnd - history.begin(), request.pageSize);
+    auto page = std::make_shared<const std::vector<ChatMessageData>>(std::make_move_iterator(pageBegin),
+                                                                     std::make_move_iterator(pageEnd));
+    emit chatHistoryPageReceived(page, request.beforeMessageId, pageBegin != history.begin());
+}
+
+void TcpClientWorker::addHistoryRequest(Request request)
+{
+    //One not yet sent history request answers for all later ones of the same kind,
+    //updates and newest pages are answered differently so they are merged separately
+    bool newestPage = request.pageSize > 0;
+    auto pendingRequest = std::find_if(requestQueue.begin(), requestQueue.end(),
+                                       [newestPage](const Request& queuedRequest){
+        return queuedRequest.message->getMessageType() == MessageType::GetHistory &&
+               (queuedRequest.pageSize > 0) == newestPage && queuedRequest.beforeMessageId.isEmpty();
+    });
+    if(pendingRequest != requestQueue.end()){
+        pendingRequest->pageSize = std::max(pendingRequest->pageSize, request.pageSize);
+        if(request.lastKnownMessageId.isEmpty()){
+            pendingRequest->lastKnownMessageId.clear();
+        }
+        pendingRequest->mergedIds.push_back(request.id);
+        pendingRequest->mergedIds.insert(pendingRequest->mergedIds.end(),
+                                         request.mergedIds.begin(), request.mergedIds.end());
+        ++mergedHistoryRequestsCount;
+        metrics->recordMergedHistoryRequest();
+        qDebug() << "History request merged with pending one," << mergedHistoryRequestsCount << "merged in total";
+        return;
+    }
+
+    queueRequest(std::move(request));
+}
+
+void TcpClientWorker::addChatMessageRequest(Request request)
+{
+    if(!serverSupportsBatch || options.chatMessageBatchSize <= 1){
+        queueRequest(std::move(request));
+        return;
+    }
+
+    chatMessageBatch.push_back(std::move(request));
+    if(chatMessageBatch.size() >= static_cast<size_t>(options.chatMessageBatchSize)){
+        flushChatMessageBatch();
+    }
+    else if(!batchLingerTimer.isActive()){
+        batchLingerTimer.start(options.chatMessageBatchLinger);
+    }
+}
+
+void TcpClientWorker::flushChatMessageBatch()
+{
+    TRACE_SCOPE("TcpClientWorker::flushChatMessageBatch");
+    batchLingerTimer.stop();
+    if(chatMessageBatch.empty()){
+        return;
+    }
+
+    if(chatMessageBatch.size() == 1){
+        auto request = std::move(chatMessageBatch.front());
+        chatMessageBatch.clear();
+        queueRequest(std::move(request));
+        return;
+    }
+
+    //Frame keeps the first message for servers reading only the base fields, batch replaces it
+    Request batchRequest(chatMessageBatch.front().message);
+    batchRequest.batch.reserve(chatMessageBatch.size());
+    for(auto& request : chatMessageBatch){
+        batchRequest.batch.push_back({request.id, std::move(request.chatMessage), request.message});
+    }
+    chatMessageBatch.clear();
+
+    qDebug() << batchRequest.batch.size() << " chat messages batched into one request";
+    queueRequest(std::move(batchRequest));
+}
+
+void TcpClientWorker::failRequest(const Request &request, const RequestFailure failure)
+{
+    if(request.batch.empty()){
+        if(!request.idCancelled){
+            emit requestFailed(request.id, failure);
+        }
+        for(auto mergedId : request.mergedIds){
+            emit requestFailed(mergedId, failure);
+        }
+        return;
+    }
+
+    for(const auto& entry : request.batch){
+        if(!entry.cancelled){
+            emit requestFailed(entry.id, failure);
+        }
+    }
+}
+
+void TcpClientWorker::queueRequest(Request request)
+{
+    setRequestPolicy(request);
+    requestQueue.push_back(std::move(request));
+    continueRequestProcessing();
+}
+
+void TcpClientWorker::setRequestPolicy(Request &request) const
+{
+    if(request.id == 0){
+        request.id = newRequestId();
+    }
+
+    //Reading history again is harmless, sending a chat message or opening a session twice is not
+    request.idempotent = request.message->getMessageType() == MessageType::GetHistory;
+    request.retriesLeft = request.idempotent ? options.requestRetries : 0;
+    request.timeout = options.requestTimeout;
+}
+
+void TcpClientWorker::failRequests(std::deque<Request> &requests, const RequestFailure failure)
+{
+    for(const auto& request : requests){
+        if(!request.expired && !request.dependsOnResume){
+            failRequest(request, failure);
+        }
+    }
+    requests.clear();
+}
+
+QString TcpClientWorker::requestTypeName(const Request &request)
+{
+    QString typeName = messageTypeToString(request.message->getMessageType());
+    return request.batch.empty() ? typeName : typeName + "Batch";
+}
+
+size_t TcpClientWorker::activeRequestsCount() const
+{
+    return std::count_if(requestsInFlight.begin(), requestsInFlight.end(), [](const Request& request){
+        return !request.expired;
+    });
+}
+
+QJsonDocument TcpClientWorker::requestToJson(const Request &request) const
+{
+    auto requestObject = request.message->toJson().object();
+    requestObject.insert(REQUEST_ID_KEY, QString::number(request.id));
+    if(!request.lastKnownMessageId.isEmpty() && request.resumeSessionId.isNull()){
+        requestObject.insert(SINCE_MESSAGE_ID_KEY, request.lastKnownMessageId);
+    }
+    if(!request.batch.empty()){
+        QJsonArray batch;
+        for(const auto& entry : request.batch){
+            batch.append(QJsonObject{
+                {MESSAGE_USERNAME_KEY, entry.chatMessage.username},
+                {MESSAGE_TEXT_KEY, entry.chatMessage.text}
+            });
+        }
+        requestObject.insert(BATCH_KEY, batch);
+    }
+    if(request.pageSize > 0){
+        requestObject.insert(PAGE_SIZE_KEY, request.pageSize);
+        if(!request.beforeMessageId.isEmpty()){
+            requestObject.insert(BEFORE_MESSAGE_ID_KEY, request.beforeMessageId);
+        }
+    }
+    if(request.message->getMessageType() == MessageType::NewSessionRequest){
+        QJsonArray supportedFeatures{RESUME_SESSION_FEATURE, BATCH_FEATURE};
+        if(options.useCborEncoding){
+            supportedFeatures.append(CBOR_ENCODING_FEATURE);
+        }
+        if(options.useCompression){
+            supportedFeatures.append(ZLIB_COMPRESSION_FEATURE);
+        }
+        requestObject.insert(FEATURES_KEY, supportedFeatures);
+
+        if(!request.resumeSessionId.isNull()){
+            requestObject.insert(RESUME_SESSION_ID_KEY, request.resumeSessionId.toString());
+            requestObject.insert(LAST_MESSAGE_ID_KEY, request.lastKnownMessageId);
+        }
+    }
+    return QJsonDocument(requestObject);
+}
+
+std::deque<TcpClientWorker::Request>::iterator TcpClientWorker::findRequestForResponse(const MessageType responseType,
+                                                                                      const QJsonObject &responseObject)
+{
+    //Servers supporting pipelining echo the request id
+    if(responseObject.contains(REQUEST_ID_KEY)){
+        auto requestId = responseObject.value(REQUEST_ID_KEY).toString().toULongLong();
+        return std::find_if(requestsInFlight.begin(), requestsInFlight.end(),
+                            [requestId](const Request& request){
+            return request.id == requestId;
+        });
+    }
+
+    //Others answer in order, so the oldest request of the matching type is the answered one
+    return std::find_if(requestsInFlight.begin(), requestsInFlight.end(),
+                        [responseType](const Request& request){
+        return responseTypeForRequest(request.message->getMessageType()) == responseType;
+    });
+}
+
+bool TcpClientWorker::takeQueuedRetry(const QJsonObject &responseObject, Request &request)
+{
+    //Late answer to the first attempt of a request waiting to be sent again answers the retry
+    if(!responseObject.contains(REQUEST_ID_KEY)){
+        return false;
+    }
+
+    auto requestId = responseObject.value(REQUEST_ID_KEY).toString().toULongLong();
+    auto retry = std::find_if(requestQueue.begin(), requestQueue.end(), [requestId](const Request& queuedRequest){
+        return queuedRequest.id == requestId && queuedRequest.sentTimer.isValid();
+    });
+    if(retry == requestQueue.end()){
+        return false;
+    }
+
+    qDebug() << "Late response to request " << requestId << " answers its queued retry";
+    request = std::move(*retry);
+    requestQueue.erase(retry);
+    return true;
+}
+
+void TcpClientWorker::expireCancelledRequest(Request &request)
+{
+    request.expired = true;
+    request.deadline.setRemainingTime(request.timeout);
+    continueRequestProcessing();
+}
+
+bool TcpClientWorker::cancelMergedRequest(Request &request, const quint64 requestId)
+{
+    auto mergedId = std::find(request.mergedIds.begin(), request.mergedIds.end(), requestId);
+    if(mergedId != request.mergedIds.end()){
+        request.mergedIds.erase(mergedId);
+        return true;
+    }
+
+    //Request still answers the merged ones, only its own id is reported as cancelled
+    if(request.id == requestId && !request.idCancelled && !request.mergedIds.empty()){
+        request.idCancelled = true;
+        return true;
+    }
+    return false;
 }
 
 void TcpClientWorker::continueRequestProcessing()
 {
-    if(!isInRequestProcessing()){
+    while(connected && !requestQueue.empty() &&
+          activeRequestsCount() < static_cast<size_t>(options.maxRequestsInFlight)){
         processTopRequest();
     }
+    metrics->recordQueueDepth(requestQueue.size(), activeRequestsCount());
 }
 
-void TcpClientWorker::finishRequest()
+void TcpClientWorker::restartRequestTimer()
 {
-    requestTimer.stop();
-    inRequestProcessing = false;
-    currentRequest = Request();
-    if(requestQueue.size() != 0){
-        requestQueue.pop();
+    if(requestsInFlight.empty()){
+        requestTimer.stop();
+        return;
     }
 
-    if(requestQueue.size() != 0){
+    auto earliestDeadline = std::min_element(requestsInFlight.begin(), requestsInFlight.end(),
+                                             [](const Request& first, const Request& second){
+        return first.deadline < second.deadline;
+    })->deadline;
+    requestTimer.start(static_cast<int>(std::max<qint64>(earliestDeadline.remainingTime(), 0)));
+}
+
+void TcpClientWorker::onRequestTimeout()
+{
+    std::deque<Request> retriedRequests;
+    for(auto request = requestsInFlight.begin(); request != requestsInFlight.end();){
+        if(!request->deadline.hasExpired()){
+            ++request;
+            continue;
+        }
+
+        if(request->expired){
+            request = requestsInFlight.erase(request);
+            continue;
+        }
+
+        metrics->recordTimeout(requestTypeName(*request));
+        if(Trace::isEnabled()){
+            Trace::addAsyncSpan("RequestTimeout", request->id, request->traceSentTime, requestTypeName(*request));
+        }
+        if(request->idempotent && request->retriesLeft > 0){
+            qWarning() << "Request " << request->id << " timed out, retries left: " << request->retriesLeft;
+            --request->retriesLeft;
+            retriedRequests.push_back(std::move(*request));
+            request = requestsInFlight.erase(request);
+            continue;
+        }
+
+        qWarning() << "Request " << request->id << " timed out";
+        request->expired = true;
+        request->deadline.setRemainingTime(request->timeout);
+        failRequest(*request, RequestFailure::Timeout);
+        ++request;
+    }
+
+    //Retries keep their ids, so a late response to the first attempt answers them too
+    requestQueue.insert(requestQueue.begin(),
+                        std::make_move_iterator(retriedRequests.begin()),
+                        std::make_move_iterator(retriedRequests.end()));
+
+    restartRequestTimer();
+    continueRequestProcessing();
+}
+
+void TcpClientWorker::addOfflineRequest(Request request)
+{
+    //Batch is split back, messages are batched again in the next session
+    if(!request.batch.empty()){
+        for(auto& entry : request.batch){
+            if(entry.cancelled){
+                continue;
+            }
+            Request messageRequest(entry.message);
+            messageRequest.id = entry.id;
+            messageRequest.chatMessage = std::move(entry.chatMessage);
+            addOfflineRequest(std::move(messageRequest));
+        }
+        return;
+    }
+
+    if(options.offlineQueueLimit <= 0){
+        qWarning() << "Chat message dropped, client is offline";
+        emit requestFailed(request.id, RequestFailure::Disconnected);
+        return;
+    }
+
+    if(offlineRequests.size() >= static_cast<size_t>(options.offlineQueueLimit)){
+        qWarning() << "Offline queue is full, the oldest chat message is dropped";
+        emit requestFailed(offlineRequests.front().id, RequestFailure::Disconnected);
+        offlineRequests.pop_front();
+    }
+
+    request.expired = false;
+    request.deadline = QDeadlineTimer();
+    offlineRequests.push_back(std::move(request));
+}
+
+void TcpClientWorker::onSessionConfirmed(const QUuid &sessionId)
+{
+    sessionConfirmed = true;
+
+    //Messages written while offline go out in the new session
+    if(!offlineRequests.empty()){
+        qDebug() << "Sending " << offlineRequests.size() << " messages queued while offline";
+    }
+    while(!offlineRequests.empty()){
+        auto request = std::move(offlineRequests.front());
+        offlineRequests.pop_front();
+        request.message = std::make_shared<AddMessageMessage>(sessionId, request.chatMessage);
+        addChatMessageRequest(std::move(request));
+    }
+    continueRequestProcessing();
+}
+
+void TcpClientWorker::keepUnsentMessages()
+{
+    //Not answered messages may have reached the server, they are sent again anyway rather than lost
+    batchLingerTimer.stop();
+    for(auto requests : {&requestsInFlight, &requestQueue, &chatMessageBatch}){
+        std::deque<Request> lostRequests;
+        for(auto& request : *requests){
+            if(request.expired){
+                continue;
+            }
+            if(request.message->getMessageType() == MessageType::AddMessage){
+                addOfflineRequest(std::move(request));
+            }
+            else{
+                lostRequests.push_back(std::move(request));
+            }
+        }
+        requests->clear();
+        failRequests(lostRequests, RequestFailure::Disconnected);
+    }
+}
+
+void TcpClientWorker::scheduleReconnect()
+{
+    //Delay is picked randomly from the upper half of the current backoff step
+    auto maxDelay = std::max(options.reconnectMaxDelay, 1);
+    auto delay = std::max(options.reconnectInitialDelay, 1);
+    for(int i = 0; i < reconnectAttempt && delay < maxDelay; ++i){
+        delay *= 2;
+    }
+    delay = std::min(delay, maxDelay);
+    delay = delay / 2 + static_cast<int>(QRandomGenerator::global()->bounded(delay / 2 + 1));
+
+    ++reconnectAttempt;
+    qDebug() << "Reconnect attempt " << reconnectAttempt << " in " << delay << " ms";
+    reconnectTimer.start(delay);
+}
+
+void TcpClientWorker::reconnect()
+{
+    if(stopping || workerSocket->state() != QTcpSocket::UnconnectedState){
+        return;
+    }
+    metrics->recordReconnectAttempt();
+    workerSocket->connectToHost(host, port);
+}
+
+void TcpClientWorker::drainPendingMessages()
+{
+    flushChatMessageBatch();
+
+    //Only chat messages are worth sending in a session which is about to close
+    requestQueue.erase(std::remove_if(requestQueue.begin(), requestQueue.end(),
+                                      [](const Request& request){
+        return request.message->getMessageType() != MessageType::AddMessage;
+    }), requestQueue.end());
+
+    if(!requestQueue.empty()){
+        qDebug() << "Sending " << requestQueue.size() << " pending messages before disconnect";
+    }
+    while(!requestQueue.empty()){
         processTopRequest();
     }
 }
 
+void TcpClientWorker::closeConnection()
+{
+    if(closingConnection){
+        return;
+    }
+    closingConnection = true;
+
+    shutdownTimer.start(DISCONNECT_TIMEOUT);
+    workerSocket->disconnectFromHost();
+}
+
+void TcpClientWorker::finishStop()
+{
+    if(!shutdownDuration.isValid()){
+        return;
+    }
+
+    shutdownTimer.stop();
+    requestTimer.stop();
+    failRequests(requestsInFlight, RequestFailure::Disconnected);
+    failRequests(requestQueue, RequestFailure::Disconnected);
+    failRequests(offlineRequests, RequestFailure::Disconnected);
+    failRequests(chatMessageBatch, RequestFailure::Disconnected);
+
+    qDebug() << "Worker stopped in " << shutdownDuration.elapsed() << " ms";
+    metrics->recordTiming("Shutdown", shutdownDuration.elapsed());
+    shutdownDuration.invalidate();
+    emit stopped();
+}
+
+void TcpClientWorker::onBytesWritten()
+{
+    if(stopping && !closingConnection && workerSocket->bytesToWrite() == 0){
+        closeConnection();
+    }
+}
+
+void TcpClientWorker::onShutdownTimeout()
+{
+    if(!closingConnection){
+        qWarning() << "Pending data was not written before disconnect, "
+                   << workerSocket->bytesToWrite() << " bytes left";
+        closeConnection();
+        return;
+    }
+
+    qWarning() << "Graceful disconnect timed out, connection is aborted";
+    workerSocket->abort();
+    finishStop();
+}
+
 void TcpClientWorker::onConnected()
 {
     connected = true;
+    reconnectAttempt = 0;
+    currentSessionResumed = false;
+    measuringSessionSetup = true;
+    sessionSetupTimer.start();
     emit startedSucessfully();
+    continueRequestProcessing();
 }
 
 void TcpClientWorker::onDisconnected()
 {
     qDebug() << "TcpClientWorker::onDisconnected()";
     connected = false;
-    emit stopped();
+    sessionConfirmed = false;
+    requestTimer.stop();
+    serverFeatures.clear();
+    serverSupportsBatch = false;
+    compressFrames = false;
+    wireEncoding = WireEncoding::Json;
+    logCompressionStats();
+
+    notificationDebounceTimer.stop();
+    notificationLatencyTimer.stop();
+    pendingNotificationsCount = 0;
+
+    if(stopping){
+        finishStop();
+        return;
+    }
+
+    //Requests of the lost session are useless in the next one, except chat messages
+    keepUnsentMessages();
+    metrics->recordConnectionLost();
+    emit connectionLost();
+    scheduleReconnect();
 }
 
 void TcpClientWorker::onSocketErrorOccured(QAbstractSocket::SocketError socketError)
 {
     qWarning() << "Socket error: " << socketError;
     qWarning() << "Socket error description: " << workerSocket->errorString();
-    if(!connected) emit stopped();
+    if(connected || stopping){
+        return;
+    }
+
+    //Only the first connection failure stops the client, a lost one is restored
+    if(reconnectTimer.isActive() || reconnectAttempt > 0){
+        scheduleReconnect();
+    }
+    else{
+        emit stopped();
+    }
 }
@@ -3,23 +3,47 @@
 
 #include <QObject>
 #include <QJsonObject>
+#include <QJsonDocument>
 #include <QTcpSocket>
 #include <QTimer>
+#include <QDeadlineTimer>
+#include <QSet>
+#include <QElapsedTimer>
+
+#include "MessageType.h"
+
+#include "TcpClientOptions.h"
+#include "WireFormat.h"
+#include "ChatHistory.h"
+#include "NewChatMessageData.h"
+#include "RequestFailure.h"
+#include "ClientMetrics.h"
 
 #include <memory>
-#include <queue>
+#include <deque>
 #include <mutex>
+#include <atomic>
 
 class SimpleMessage;
 class NotificationMessage;
+class NewSessionResponseMessage;
+class AddMessageResponseMessage;
 
 struct ChatMessageData;
-struct NewChatMessageData;
 
 class TcpClientWorker : public QObject
 {
     Q_OBJECT
 
+    struct BatchEntry{
+        quint64 id;
+        NewChatMessageData chatMessage;
+        //Own message of the entry, the frame is sent with the one of its first entry
+        std::shared_ptr<SimpleMessage> message;
+        //Entries cancelled after sending stay, so results keep matching their positions
+        bool cancelled = false;
+    };
+
     struct Request{
         explicit Request(std::shared_ptr<SimpleMessage> requestMessage = nullptr,
                          bool waitForResponseToRequest = true) :
@@ -35,53 +59,184 @@ class TcpClientWorker : public QObject
 
         std::shared_ptr<SimpleMessage> message;
         bool waitForResponse;
+        QString lastKnownMessageId;
+        QString beforeMessageId;
+        int pageSize = 0;
+
+        //Kept to send the message again in the next session if connection is lost
+        NewChatMessageData chatMessage;
+
+        //Chat messages sent together in one AddMessage frame, answered with a result for each
+        std::vector<BatchEntry> batch;
+
+        //Session resume attempt and requests sent in the resumed session before it was accepted
+        QUuid resumeSessionId;
+        bool dependsOnResume = false;
+        bool discardResponse = false;
+
+        quint64 id = 0;
+        //Ids of later requests merged into this one, they are answered and failed together with it.
+        //A cancelled id stays on the frame while merged requests still wait for it
+        std::vector<quint64> mergedIds;
+        bool idCancelled = false;
+        QDeadlineTimer deadline;
+        QElapsedTimer sentTimer;
+        qint64 traceSentTime = 0;
+
+        //Idempotent requests are sent again after a timeout while retries are left,
+        //others fail right away. Expired requests wait a while for late responses to discard them
+        int timeout = 0;
+        int retriesLeft = 0;
+        bool idempotent = false;
+        bool expired = false;
     };
 
 public:
-    explicit TcpClientWorker(QObject *parent = nullptr);
+    explicit TcpClientWorker(const TcpClientOptions& options = TcpClientOptions(),
+                             std::shared_ptr<ClientMetrics> metrics = nullptr,
+                             QObject *parent = nullptr);
+
+    //Ids are unique for all workers, so they can be given out on any thread before queueing
+    static quint64 newRequestId();
 
 public slots:
     void init();
     void start(const QString &host, const quint16 port);
     void stop();
 
-    void requestNewSessionRequest(const QUuid& userId, const QString& username);
-    void confirmSessionRequest(const QUuid& userId, const QUuid& sessionId);
+    void requestNewSessionRequest(const quint64 requestId, const QUuid& userId, const QString& username);
+    void resumeSessionRequest(const quint64 requestId, const QUuid& userId, const QString& username,
+                              const QUuid& sessionId, const QString& lastKnownMessageId);
+    void confirmSessionRequest(const quint64 requestId, const QUuid& userId, const QUuid& sessionId);
+
+    void addGetChatRequest(const quint64 requestId, const QUuid& sessionId);
+    void addGetChatUpdatesRequest(const quint64 requestId, const QUuid& sessionId, const QString& lastKnownMessageId);
+    void addGetChatPageRequest(const quint64 requestId, const QUuid& sessionId,
+                               const QString& beforeMessageId, const int pageSize);
+    void addSendChatMessageRequest(const quint64 requestId, const QUuid& sessionId, const NewChatMessageData& message);
 
-    void addGetChatRequest(const QUuid& sessionId);
-    void addSendChatMessageRequest(const QUuid& sessionId, const NewChatMessageData& message);
+    void cancelRequest(const quint64 requestId);
 
 signals:    
     void startedSucessfully();
 
     void newSessionInitiated(bool initSuccess, const QUuid& userId, const QUuid& sessionId);
-
-    void chatHistoryReceived(const std::vector<ChatMessageData> history);
-    void chatMessageSentSuccess();
+    void sessionResumed(const QUuid& userId, const QUuid& sessionId);
+    void sessionReady(bool resumed, qint64 connectToReadyTime);
+
+    void chatHistoryReceived(const ChatHistory history);
+    void newChatMessagesReceived(const ChatHistory newMessages);
+    //Before message id is empty for the newest page
+    void chatHistoryPageReceived(const ChatHistory page, const QString beforeMessageId, bool hasOlderMessages);
+    void chatMessageSentSuccess(quint64 requestId, const QString& messageId);
     void chatHasBeenUpdated();
 
     void stopped();
+    void connectionLost();
+
+    void requestFailed(quint64 requestId, RequestFailure failure);
 
 private:;
-    std::queue<Request> requestQueue;
-    Request currentRequest;
+    TcpClientOptions options;
+    std::shared_ptr<ClientMetrics> metrics;
+
+    std::deque<Request> requestQueue;
+    std::deque<Request> requestsInFlight;
+    static std::atomic<quint64> lastRequestId;
 
     std::unique_ptr<QTcpSocket> workerSocket;
     QTimer requestTimer;
 
+    QSet<QString> serverFeatures;
+    bool serverSupportsResume;
+    bool serverSupportsBatch;
+
+    std::deque<Request> chatMessageBatch;
+    QTimer batchLingerTimer;
+    WireEncoding wireEncoding;
+    bool compressFrames;
+
+    QTimer notificationDebounceTimer;
+    QTimer notificationLatencyTimer;
+    int pendingNotificationsCount;
+    quint64 mergedNotificationsCount;
+    quint64 mergedHistoryRequestsCount;
+
     std::mutex socketStateMutex;
-    bool inRequestProcessing;
 
     bool connected;
+    bool stopping;
+    bool closingConnection;
+    QTimer shutdownTimer;
+    QElapsedTimer shutdownDuration;
+    bool sessionConfirmed;
+
+    QString host;
+    quint16 port;
+    QTimer reconnectTimer;
+    int reconnectAttempt;
+    std::deque<Request> offlineRequests;
+
+    QElapsedTimer sessionSetupTimer;
+    bool measuringSessionSetup;
+    bool currentSessionResumed;
 
     void onReadyRead();
     void processTopRequest();
     void processNotification(std::shared_ptr<NotificationMessage> notitification);
-    void processMessageData(const QByteArray& data, bool& responseReceived);
+    void flushNotifications();
+    void processMessageData(const QByteArray& data);
+    QByteArray compressFrame(const QByteArray& data);
+    QByteArray decompressFrame(const QByteArray& data);
+    void logCompressionStats() const;
+    void processNewSessionResponse(const QJsonObject& responseObject);
+    bool processResumeResponse(const Request& request,
+                               std::shared_ptr<NewSessionResponseMessage> responseMessage,
+                               const QJsonObject& responseObject);
+    void dropResumeRequests();
+    void reportSessionReady();
+    void processHistoryResponse(const Request& request,
+                                std::vector<ChatMessageData> history,
+                                const QJsonObject& responseObject);
+    void processHistoryPageResponse(const Request& request,
+                                    std::vector<ChatMessageData> history,
+                                    const QJsonObject& responseObject);
+
+    void addHistoryRequest(Request request);
+    void addChatMessageRequest(Request request);
+    void flushChatMessageBatch();
+    void processBatchResponse(const Request& request,
+                              std::shared_ptr<AddMessageResponseMessage> responseMessage,
+                              const QJsonObject& responseObject);
+    void failRequest(const Request& request, const RequestFailure failure);
+    void queueRequest(Request request);
+    void setRequestPolicy(Request& request) const;
+    void failRequests(std::deque<Request>& requests, const RequestFailure failure);
+    size_t activeRequestsCount() const;
+    static QString requestTypeName(const Request& request);
+
+    QJsonDocument requestToJson(const Request& request) const;
+    std::deque<Request>::iterator findRequestForResponse(const MessageType responseType,
+                                                         const QJsonObject& responseObject);
+    bool takeQueuedRetry(const QJsonObject& responseObject, Request& request);
+    bool cancelMergedRequest(Request& request, const quint64 requestId);
+    void expireCancelledRequest(Request& request);
 
-   bool isInRequestProcessing() const;
    void continueRequestProcessing();
-   void finishRequest();
+   void restartRequestTimer();
+   void onRequestTimeout();
+
+   void addOfflineRequest(Request request);
+   void onSessionConfirmed(const QUuid& sessionId);
+   void keepUnsentMessages();
+   void scheduleReconnect();
+   void reconnect();
+
+   void drainPendingMessages();
+   void closeConnection();
+   void finishStop();
+   void onBytesWritten();
+   void onShutdownTimeout();
 
 private slots:
    void onConnected();
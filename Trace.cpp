@@ -0,0 +1,170 @@
+#include "Trace.h"
+
+#include <QElapsedTimer>
+#include <QSaveFile>
+#include <QThread>
+#include <QCoreApplication>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <mutex>
+#include <vector>
+
+#include <QDebug>
+
+namespace{
+    //Memory for about a minute of busy tracing, later events are dropped
+    const size_t MAX_EVENTS = 2000000;
+
+    struct Event{
+        const char* name;
+        char phase;
+        int threadIndex;
+        qint64 time;
+        qint64 duration;
+        quint64 id;
+        QString detail;
+    };
+
+    struct ThreadInfo{
+        int index;
+        QString name;
+    };
+
+    std::mutex traceMutex;
+    QElapsedTimer traceClock;
+    QString traceFilePath;
+    std::vector<Event> events;
+    std::vector<ThreadInfo> threads;
+    bool eventsDropped = false;
+
+    thread_local int currentThreadIndex = 0;
+
+    //Must be called with the lock held
+    int threadIndex(){
+        if(currentThreadIndex == 0){
+            currentThreadIndex = static_cast<int>(threads.size()) + 1;
+            auto threadName = QThread::currentThread()->objectName();
+            if(threadName.isEmpty()){
+                threadName = QString("Thread %1").arg(currentThreadIndex);
+            }
+            threads.push_back({currentThreadIndex, threadName});
+        }
+        return currentThreadIndex;
+    }
+
+    void addEvent(Event event){
+        std::lock_guard<std::mutex> lock(traceMutex);
+        if(!Trace::isEnabled()){
+            return;
+        }
+        if(events.size() >= MAX_EVENTS){
+            eventsDropped = true;
+            return;
+        }
+        event.threadIndex = threadIndex();
+        events.push_back(std::move(event));
+    }
+
+    QByteArray escapedString(const QString& string){
+        //Serializing an object is the simplest way to get a string escaped as JSON
+        auto object = QJsonDocument(QJsonObject{{"", string}}).toJson(QJsonDocument::Compact);
+        return object.mid(4, object.size() - 5);
+    }
+}
+
+std::atomic<bool> Trace::enabled{false};
+
+bool Trace::start(const QString &filePath)
+{
+    std::lock_guard<std::mutex> lock(traceMutex);
+    if(isEnabled()){
+        qWarning() << "Tracing already started";
+        return false;
+    }
+
+    traceFilePath = filePath;
+    events.clear();
+    eventsDropped = false;
+    traceClock.start();
+    enabled.store(true, std::memory_order_relaxed);
+    qDebug() << "Tracing to " << filePath;
+    return true;
+}
+
+bool Trace::stop()
+{
+    std::lock_guard<std::mutex> lock(traceMutex);
+    if(!isEnabled()){
+        return false;
+    }
+    enabled.store(false, std::memory_order_relaxed);
+
+    if(eventsDropped){
+        qWarning() << "Trace is incomplete, events after the first " << MAX_EVENTS << " were dropped";
+    }
+
+    QSaveFile file(traceFilePath);
+    if(!file.open(QIODevice::WriteOnly)){
+        qWarning() << "Can't write trace to " << traceFilePath << ": " << file.errorString();
+        return false;
+    }
+
+    auto pid = QCoreApplication::applicationPid();
+    file.write("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    auto writeEvent = [&file, &first](const QByteArray& event){
+        if(!first){
+            file.write(",\n");
+        }
+        first = false;
+        file.write(event);
+    };
+
+    for(const auto& thread : threads){
+        writeEvent(QString("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%1,\"tid\":%2,\"args\":{\"name\":")
+                   .arg(pid).arg(thread.index).toUtf8() + escapedString(thread.name) + "}}");
+    }
+
+    for(const auto& event : events){
+        auto header = [pid, &event](const qint64 time){
+            return QString("{\"name\":\"%1\",\"pid\":%2,\"tid\":%3,\"ts\":%4")
+                    .arg(QString::fromUtf8(event.name)).arg(pid).arg(event.threadIndex).arg(time).toUtf8();
+        };
+        switch (event.phase) {
+            case 'X':
+                writeEvent(header(event.time) + ",\"ph\":\"X\",\"dur\":" + QByteArray::number(event.duration) + "}");
+                break;
+            case 'b':{
+                auto asyncFields = ",\"cat\":\"request\",\"id\":" + QByteArray::number(event.id);
+                auto args = event.detail.isEmpty() ? QByteArray()
+                                                   : ",\"args\":{\"detail\":" + escapedString(event.detail) + "}";
+                writeEvent(header(event.time) + ",\"ph\":\"b\"" + asyncFields + args + "}");
+                writeEvent(header(event.time + event.duration) + ",\"ph\":\"e\"" + asyncFields + "}");
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    file.write("\n]}\n");
+    qDebug() << "Trace of " << events.size() << " events written to " << traceFilePath;
+    events.clear();
+    return file.commit();
+}
+
+qint64 Trace::now()
+{
+    return traceClock.nsecsElapsed() / 1000;
+}
+
+void Trace::addSpan(const char *name, const qint64 startTime, const qint64 duration)
+{
+    addEvent({name, 'X', 0, startTime, duration, 0, QString()});
+}
+
+void Trace::addAsyncSpan(const char *name, const quint64 id, const qint64 startTime, const QString &detail)
+{
+    addEvent({name, 'b', 0, startTime, now() - startTime, id, detail});
+}
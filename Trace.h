@@ -0,0 +1,57 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+#include <QtGlobal>
+
+#include <atomic>
+
+//Spans of all threads written as Chrome trace events, open the file in chrome://tracing or Perfetto.
+//While tracing is off a span costs one relaxed atomic load
+namespace Trace{
+    extern std::atomic<bool> enabled;
+
+    inline bool isEnabled(){
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    //Events are kept in memory and written to the file on stop
+    bool start(const QString& filePath);
+    bool stop();
+
+    //Microseconds since tracing started
+    qint64 now();
+
+    //Names must be string literals, only pointers to them are kept
+    void addSpan(const char* name, const qint64 startTime, const qint64 duration);
+    //Spans overlapping on one thread, like requests in flight, are shown as async ones keyed by id
+    void addAsyncSpan(const char* name, const quint64 id, const qint64 startTime, const QString& detail = QString());
+
+    class Scope
+    {
+    public:
+        explicit Scope(const char* name)
+            : name(isEnabled() ? name : nullptr),
+            startTime(this->name != nullptr ? now() : 0)
+        {}
+
+        ~Scope(){
+            if(name != nullptr){
+                addSpan(name, startTime, now() - startTime);
+            }
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        const char* name;
+        qint64 startTime;
+    };
+}
+
+#define TRACE_CONCAT_IMPL(first, second) first##second
+#define TRACE_CONCAT(first, second) TRACE_CONCAT_IMPL(first, second)
+#define TRACE_SCOPE(name) Trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#endif // TRACE_H
@@ -0,0 +1,508 @@
+#include "WireFormat.h"
+
+#include <QCborStreamReader>
+#include <QCborStreamWriter>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QUuid>
+#include <QtEndian>
+
+#include "GetHistoryResponseMessage.h"
+
+#include "Trace.h"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+
+const int UUID_STRING_LENGTH = 38;
+const char COMPRESSED_FRAME_MARKER = 0x01;
+//Values nested deeper are refused instead of recursing further, messages of the protocol have a few levels
+const int MAX_CBOR_NESTING_DEPTH = 32;
+//Map with an id and a text, each a one byte string
+const int MIN_CBOR_CHAT_MESSAGE_SIZE = 11;
+//Larger doubles may not hold whole numbers exactly, they are written as doubles
+const double MAX_EXACT_INTEGER_DOUBLE = 9007199254740992.0;
+//qCompress puts the original size before the data, larger frames are refused before allocating for them
+const int COMPRESSED_SIZE_HEADER_LENGTH = 4;
+const quint32 MAX_DECOMPRESSED_FRAME_SIZE = 64 * 1024 * 1024;
+
+const QString MESSAGE_ID_KEY = "Id";
+const QString MESSAGE_USERNAME_KEY = "Username";
+const QString MESSAGE_TEXT_KEY = "Text";
+const QString MESSAGE_POST_TIME_KEY = "Time";
+
+//Fields which tell history responses apart and the key of their messages, taken from an empty
+//response so they follow the message library
+struct HistoryResponseLayout{
+    QJsonObject markers;
+    QString historyKey;
+};
+
+const HistoryResponseLayout& historyResponseLayout(){
+    static const auto layout = [](){
+        HistoryResponseLayout layout;
+        auto object = GetHistoryResponseMessage(std::vector<ChatMessageData>()).toJson().object();
+        for(auto it = object.constBegin(); it != object.constEnd(); ++it){
+            if(it.value().isArray()){
+                layout.historyKey = it.key();
+            }
+            else{
+                layout.markers.insert(it.key(), it.value());
+            }
+        }
+        return layout;
+    }();
+    return layout;
+}
+
+bool isHistoryResponse(const QJsonObject& object){
+    const auto& markers = historyResponseLayout().markers;
+    for(auto it = markers.constBegin(); it != markers.constEnd(); ++it){
+        if(object.value(it.key()) != it.value()){
+            return false;
+        }
+    }
+    return true;
+}
+
+//Written straight from the JSON values, without building CBOR values in between
+void writeCborValue(QCborStreamWriter& writer, const QJsonValue& value){
+    switch (value.type()) {
+        case QJsonValue::Object:{
+            auto object = value.toObject();
+            writer.startMap(object.size());
+            for(auto it = object.constBegin(); it != object.constEnd(); ++it){
+                writer.append(it.key());
+                writeCborValue(writer, it.value());
+            }
+            writer.endMap();
+            break;
+        }
+        case QJsonValue::Array:{
+            auto array = value.toArray();
+            writer.startArray(array.size());
+            for(const auto& arrayValue : array){
+                writeCborValue(writer, arrayValue);
+            }
+            writer.endArray();
+            break;
+        }
+        case QJsonValue::String:{
+            //UUIDs go as 16 bytes instead of 38 characters, but only if they can be restored exactly
+            auto string = value.toString();
+            if(string.size() == UUID_STRING_LENGTH){
+                QUuid uuid(string);
+                if(!uuid.isNull() && uuid.toString() == string){
+                    writer.append(QCborKnownTags::Uuid);
+                    writer.append(uuid.toRfc4122());
+                    break;
+                }
+            }
+            writer.append(string);
+            break;
+        }
+        case QJsonValue::Double:{
+            //Whole numbers go as integers, as QCborValue::fromJsonValue() does
+            auto number = value.toDouble();
+            if(std::abs(number) < MAX_EXACT_INTEGER_DOUBLE && std::trunc(number) == number){
+                writer.append(static_cast<qint64>(number));
+            }
+            else{
+                writer.append(number);
+            }
+            break;
+        }
+        case QJsonValue::Bool:
+            writer.append(value.toBool());
+            break;
+        case QJsonValue::Null:
+            writer.appendNull();
+            break;
+        default:
+            writer.appendUndefined();
+            break;
+    }
+}
+
+bool isJsonData(const QByteArray& data){
+    for(auto character : data){
+        if(!QChar::isSpace(static_cast<uchar>(character))){
+            return character == '{';
+        }
+    }
+    return false;
+}
+
+QString valueToText(const QJsonValue& value){
+    if(value.isString()){
+        return value.toString();
+    }
+    if(value.isDouble()){
+        //toInteger() is missing in Qt 5, numbers of messages are integers anyway
+        return QString::number(static_cast<qint64>(value.toDouble()));
+    }
+    return QString();
+}
+
+//Sets the field of the message for the key, returns false for keys chat messages don't have
+bool setChatMessageField(ChatMessageData& message, const QString& key, const QJsonValue& value){
+    if(key == MESSAGE_ID_KEY){
+        message.id = valueToText(value);
+    }
+    else if(key == MESSAGE_USERNAME_KEY){
+        message.username = valueToText(value);
+    }
+    else if(key == MESSAGE_TEXT_KEY){
+        message.text = valueToText(value);
+    }
+    else if(key == MESSAGE_POST_TIME_KEY){
+        message.postTime = valueToText(value);
+    }
+    else{
+        return false;
+    }
+    return true;
+}
+
+bool isChatMessageObject(const QJsonObject& object){
+    ChatMessageData message;
+    for(auto it = object.constBegin(); it != object.constEnd(); ++it){
+        if(!setChatMessageField(message, it.key(), it.value())){
+            return false;
+        }
+    }
+    return object.contains(MESSAGE_ID_KEY) && object.contains(MESSAGE_TEXT_KEY);
+}
+
+QString readCborString(QCborStreamReader& reader){
+    QString string;
+    auto chunk = reader.readString();
+    while(chunk.status == QCborStreamReader::Ok){
+        string += chunk.data;
+        chunk = reader.readString();
+    }
+    return string;
+}
+
+QByteArray readCborByteArray(QCborStreamReader& reader){
+    QByteArray bytes;
+    auto chunk = reader.readByteArray();
+    while(chunk.status == QCborStreamReader::Ok){
+        bytes += chunk.data;
+        chunk = reader.readByteArray();
+    }
+    return bytes;
+}
+
+//Same conversion as cborToJson, but read from the stream. Depth is the number of containers and tags
+//around the value
+QJsonValue readCborValue(QCborStreamReader& reader, const int depth){
+    if(depth > MAX_CBOR_NESTING_DEPTH && (reader.isContainer() || reader.isTag())){
+        //Skipping without recursion leaves the reader with a nesting error, which fails the whole message
+        reader.next(0);
+        return QJsonValue();
+    }
+
+    switch (reader.type()) {
+        case QCborStreamReader::UnsignedInteger:
+        case QCborStreamReader::NegativeInteger:{
+            auto value = reader.toInteger();
+            reader.next();
+            return QJsonValue(value);
+        }
+        case QCborStreamReader::String:
+            return readCborString(reader);
+        case QCborStreamReader::ByteArray:
+            return QString::fromLatin1(readCborByteArray(reader).toBase64(QByteArray::Base64UrlEncoding |
+                                                                          QByteArray::OmitTrailingEquals));
+        case QCborStreamReader::Array:{
+            QJsonArray array;
+            reader.enterContainer();
+            while(reader.lastError() == QCborError::NoError && reader.hasNext()){
+                array.append(readCborValue(reader, depth + 1));
+            }
+            reader.leaveContainer();
+            return array;
+        }
+        case QCborStreamReader::Map:{
+            QJsonObject object;
+            reader.enterContainer();
+            while(reader.lastError() == QCborError::NoError && reader.hasNext()){
+                auto key = reader.isString() ? readCborString(reader)
+                                             : valueToText(readCborValue(reader, depth + 1));
+                object.insert(key, readCborValue(reader, depth + 1));
+            }
+            reader.leaveContainer();
+            return object;
+        }
+        case QCborStreamReader::Tag:{
+            auto tag = reader.toTag();
+            reader.next();
+            if(tag == QCborTag(QCborKnownTags::Uuid) && reader.isByteArray()){
+                return QUuid::fromRfc4122(readCborByteArray(reader)).toString();
+            }
+            return readCborValue(reader, depth + 1);
+        }
+        case QCborStreamReader::SimpleType:{
+            QJsonValue value;
+            if(reader.isBool()){
+                value = reader.toBool();
+            }
+            reader.next();
+            return value;
+        }
+        case QCborStreamReader::Float16:{
+            double value = reader.toFloat16();
+            reader.next();
+            return value;
+        }
+        case QCborStreamReader::Float:{
+            double value = reader.toFloat();
+            reader.next();
+            return value;
+        }
+        case QCborStreamReader::Double:{
+            auto value = reader.toDouble();
+            reader.next();
+            return value;
+        }
+        default:
+            reader.next();
+            return QJsonValue();
+    }
+}
+
+//Fields of chat messages are read into the message directly, without an object per message.
+//Messages are elements of an array in the top level map, so their values are at the third level
+bool readCborChatMessage(QCborStreamReader& reader, ChatMessageData& message, QJsonObject* object){
+    bool isChatMessage = true;
+    bool hasId = false;
+    bool hasText = false;
+    reader.enterContainer();
+    while(reader.lastError() == QCborError::NoError && reader.hasNext()){
+        auto key = reader.isString() ? readCborString(reader) : valueToText(readCborValue(reader, 3));
+        auto value = readCborValue(reader, 3);
+        hasId = hasId || key == MESSAGE_ID_KEY;
+        hasText = hasText || key == MESSAGE_TEXT_KEY;
+        isChatMessage = setChatMessageField(message, key, value) && isChatMessage;
+        if(object != nullptr){
+            object->insert(key, value);
+        }
+    }
+    reader.leaveContainer();
+    return isChatMessage && hasId && hasText;
+}
+
+//Array is a value of the top level map, its elements are at the second level
+QJsonValue readCborArray(QCborStreamReader& reader, const qint64 dataSize,
+                         std::vector<ChatMessageData>& history, bool& isHistory){
+    isHistory = false;
+    //Length comes from the wire, no more messages than the data can hold are reserved
+    auto length = reader.isLengthKnown() ? std::min<quint64>(reader.length(), dataSize / MIN_CBOR_CHAT_MESSAGE_SIZE)
+                                         : 0;
+    QJsonArray array;
+    reader.enterContainer();
+
+    //First element tells whether this is the array of chat messages
+    if(history.empty() && reader.hasNext() && reader.isMap()){
+        ChatMessageData message;
+        QJsonObject firstObject;
+        if(readCborChatMessage(reader, message, &firstObject)){
+            isHistory = true;
+            history.reserve(length);
+            history.push_back(std::move(message));
+            while(reader.lastError() == QCborError::NoError && reader.hasNext() && reader.isMap()){
+                ChatMessageData nextMessage;
+                readCborChatMessage(reader, nextMessage, nullptr);
+                history.push_back(std::move(nextMessage));
+            }
+        }
+        else{
+            array.append(firstObject);
+        }
+    }
+
+    while(reader.lastError() == QCborError::NoError && reader.hasNext()){
+        auto value = readCborValue(reader, 2);
+        if(!isHistory){
+            array.append(value);
+        }
+    }
+    reader.leaveContainer();
+    return array;
+}
+
+QJsonArray historyToJson(const std::vector<ChatMessageData>& history){
+    QJsonArray array;
+    for(const auto& message : history){
+        array.append(QJsonObject{
+            {MESSAGE_ID_KEY, message.id},
+            {MESSAGE_USERNAME_KEY, message.username},
+            {MESSAGE_TEXT_KEY, message.text},
+            {MESSAGE_POST_TIME_KEY, message.postTime}
+        });
+    }
+    return array;
+}
+
+bool decodeCborMessage(const QByteArray &data, QJsonObject &object,
+                       std::vector<ChatMessageData> &history, QString &errorString){
+    QCborStreamReader reader(data);
+    if(!reader.isMap()){
+        errorString = "CBOR value is not a map";
+        return false;
+    }
+
+    const auto& historyKey = historyResponseLayout().historyKey;
+    reader.enterContainer();
+    while(reader.lastError() == QCborError::NoError && reader.hasNext()){
+        auto key = reader.isString() ? readCborString(reader) : valueToText(readCborValue(reader, 1));
+        if(reader.isArray() && key == historyKey){
+            bool isHistory = false;
+            object.insert(key, readCborArray(reader, data.size(), history, isHistory));
+        }
+        else{
+            object.insert(key, readCborValue(reader, 1));
+        }
+    }
+    reader.leaveContainer();
+
+    if(reader.lastError() != QCborError::NoError){
+        errorString = reader.lastError().toString();
+        return false;
+    }
+
+    //Type may come after the messages, another message with such an array gets it back
+    if(!history.empty() && !isHistoryResponse(object)){
+        object.insert(historyKey, historyToJson(history));
+        history.clear();
+    }
+    return true;
+}
+
+bool takeJsonHistory(QJsonObject& object, std::vector<ChatMessageData>& history){
+    if(!isHistoryResponse(object)){
+        return false;
+    }
+
+    auto it = object.find(historyResponseLayout().historyKey);
+    if(it == object.end() || !it.value().isArray()){
+        return false;
+    }
+
+    auto array = it.value().toArray();
+    if(array.isEmpty() || !isChatMessageObject(array.first().toObject())){
+        return false;
+    }
+
+    history.reserve(array.size());
+    for(const auto& value : array){
+        auto messageObject = value.toObject();
+        ChatMessageData message;
+        for(auto field = messageObject.constBegin(); field != messageObject.constEnd(); ++field){
+            setChatMessageField(message, field.key(), field.value());
+        }
+        history.push_back(std::move(message));
+    }
+    it.value() = QJsonArray();
+    return true;
+}
+
+QByteArray WireFormat::encodeMessage(const QJsonDocument &document, const WireEncoding encoding)
+{
+    TRACE_SCOPE("WireFormat::encodeMessage");
+    switch (encoding) {
+        case WireEncoding::Cbor:{
+            QByteArray data;
+            QCborStreamWriter writer(&data);
+            writeCborValue(writer, document.object());
+            return data;
+        }
+        case WireEncoding::Json:
+        default:
+            return document.toJson(QJsonDocument::Compact);
+    }
+}
+
+bool WireFormat::decodeMessage(const QByteArray &data, QJsonDocument &document, QString &errorString)
+{
+    TRACE_SCOPE("WireFormat::decodeMessage");
+    if(isJsonData(data)){
+        QJsonParseError jsonParseError;
+        document = QJsonDocument::fromJson(data, &jsonParseError);
+        if(document.isNull()){
+            errorString = jsonParseError.errorString();
+            return false;
+        }
+    }
+    else{
+        //Read as a stream into JSON values, the same work as parsing JSON
+        QCborStreamReader reader(data);
+        if(!reader.isMap()){
+            errorString = "CBOR value is not a map";
+            return false;
+        }
+        auto value = readCborValue(reader, 0);
+        if(reader.lastError() != QCborError::NoError){
+            errorString = reader.lastError().toString();
+            return false;
+        }
+        document = QJsonDocument(value.toObject());
+    }
+
+    if(!document.isObject()){
+        errorString = "Message is not an object";
+        return false;
+    }
+    return true;
+}
+
+bool WireFormat::decodeMessage(const QByteArray &data, QJsonObject &object,
+                               std::vector<ChatMessageData> &history, QString &errorString)
+{
+    TRACE_SCOPE("WireFormat::decodeMessage");
+    history.clear();
+    object = QJsonObject();
+
+    if(!isJsonData(data)){
+        return decodeCborMessage(data, object, history, errorString);
+    }
+
+    //Qt has no streaming JSON reader, but messages are still built without an intermediate copy
+    QJsonDocument document;
+    if(!decodeMessage(data, document, errorString)){
+        return false;
+    }
+    object = document.object();
+    document = QJsonDocument();
+    takeJsonHistory(object, history);
+    return true;
+}
+
+QByteArray WireFormat::compressFrame(const QByteArray &data)
+{
+    TRACE_SCOPE("WireFormat::compressFrame");
+    return COMPRESSED_FRAME_MARKER + qCompress(data);
+}
+
+bool WireFormat::isCompressedFrame(const QByteArray &data)
+{
+    return !data.isEmpty() && data.at(0) == COMPRESSED_FRAME_MARKER;
+}
+
+QByteArray WireFormat::decompressFrame(const QByteArray &data)
+{
+    TRACE_SCOPE("WireFormat::decompressFrame");
+    if(!isCompressedFrame(data) || data.size() < 1 + COMPRESSED_SIZE_HEADER_LENGTH){
+        return QByteArray();
+    }
+
+    auto originalSize = qFromBigEndian<quint32>(data.constData() + 1);
+    if(originalSize > MAX_DECOMPRESSED_FRAME_SIZE){
+        qWarning() << "Compressed frame claims " << originalSize << " bytes, more than allowed";
+        return QByteArray();
+    }
+    return qUncompress(reinterpret_cast<const uchar*>(data.constData() + 1), data.size() - 1);
+}
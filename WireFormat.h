@@ -0,0 +1,37 @@
+#ifndef WIREFORMAT_H
+#define WIREFORMAT_H
+
+#include <QByteArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QString>
+
+#include "ChatMessageData.h"
+
+#include <vector>
+
+enum class WireEncoding{
+    Json,
+    Cbor
+};
+
+namespace WireFormat{
+    QByteArray encodeMessage(const QJsonDocument& document, const WireEncoding encoding);
+
+    //Encoding of received data is detected from its first byte
+    bool decodeMessage(const QByteArray& data, QJsonDocument& document, QString& errorString);
+
+    //Chat messages of history responses are built straight into history and their array is left empty
+    //in the object, CBOR data is read as a stream so the whole message is never materialized.
+    //Other messages are decoded whole
+    bool decodeMessage(const QByteArray& data, QJsonObject& object,
+                       std::vector<ChatMessageData>& history, QString& errorString);
+
+    //Compressed frames start with a marker byte no JSON or CBOR message starts with
+    QByteArray compressFrame(const QByteArray& data);
+    bool isCompressedFrame(const QByteArray& data);
+    //Returns empty data if frame is damaged
+    QByteArray decompressFrame(const QByteArray& data);
+}
+
+#endif // WIREFORMAT_H
@@ -0,0 +1,470 @@
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QLoggingCategory>
+#include <QRandomGenerator>
+#include <QSaveFile>
+#include <QDateTime>
+#include <QUuid>
+#include <QImage>
+#include <QPainter>
+#include <QStyleOptionViewItem>
+#include <QTextStream>
+
+#include "MessageModel.h"
+#include "MessageItemDelegate.h"
+#include "MessagesViewer.h"
+#include "MessageDataRole.h"
+#include "WireFormat.h"
+
+#include "GetHistoryResponseMessage.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <numeric>
+#include <vector>
+
+#include <QDebug>
+
+//Runs on the offscreen platform unless another one is forced, results are written as JSON for comparison
+const QList<int> DEFAULT_SIZES = {1000, 10000, 100000};
+const int DEFAULT_ITERATIONS = 5;
+const int RANDOM_SEED = 20240101;
+const int USERNAMES_COUNT = 20;
+const int MAX_TEXT_WORDS = 80;
+const int PAINTED_ROWS = 1000;
+const QSize VIEWER_SIZE(400, 600);
+const int RESIZED_VIEWER_WIDTH = 520;
+const int ALLOCATION_CHECK_SIZE = 100000;
+
+//Allocations of the thread which enabled counting, other threads of Qt are not measured
+struct AllocationCounts{
+    bool enabled = false;
+    quint64 allocations = 0;
+    quint64 bytes = 0;
+    //Allocations of exactly this size are counted separately, to spot copies of one known block
+    size_t watchedSize = 0;
+    quint64 watchedAllocations = 0;
+};
+thread_local AllocationCounts allocationCounts;
+
+void* operator new(std::size_t size){
+    if(allocationCounts.enabled){
+        ++allocationCounts.allocations;
+        allocationCounts.bytes += size;
+        if(size == allocationCounts.watchedSize){
+            ++allocationCounts.watchedAllocations;
+        }
+    }
+    if(auto memory = std::malloc(size == 0 ? 1 : size)){
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept{
+    std::free(memory);
+}
+
+const QList<int> MODEL_ROLES = {
+    MessageDataRole::Id,
+    MessageDataRole::Username,
+    MessageDataRole::Text,
+    MessageDataRole::Time,
+    MessageDataRole::TimeText,
+    MessageDataRole::Status
+};
+
+const char* roleName(const int role){
+    switch (role) {
+        case MessageDataRole::Id:
+            return "Id";
+        case MessageDataRole::Username:
+            return "Username";
+        case MessageDataRole::Text:
+            return "Text";
+        case MessageDataRole::Time:
+            return "Time";
+        case MessageDataRole::TimeText:
+            return "TimeText";
+        case MessageDataRole::Status:
+            return "Status";
+        default:
+            return "Unknown";
+    }
+}
+
+//Same messages for every run, texts from one word to a few wrapped lines
+ChatHistory syntheticHistory(const int size){
+    QRandomGenerator random(RANDOM_SEED);
+    auto postTime = QDateTime(QDate(2024, 1, 1), QTime(0, 0)).toMSecsSinceEpoch();
+
+    auto messages = std::make_shared<std::vector<ChatMessageData>>();
+    messages->reserve(size);
+    for(int i = 0; i < size; ++i){
+        //Ids come from the seeded generator too, so cache keys and id hashing are the same every run
+        QByteArray idBytes(16, Qt::Uninitialized);
+        for(int byte = 0; byte < idBytes.size(); ++byte){
+            idBytes[byte] = static_cast<char>(random.bounded(256));
+        }
+
+        ChatMessageData message;
+        message.id = QUuid::fromRfc4122(idBytes).toString();
+        message.username = QString("user%1").arg(random.bounded(USERNAMES_COUNT));
+
+        QStringList words;
+        auto wordsCount = 1 + random.bounded(MAX_TEXT_WORDS);
+        for(int word = 0; word < wordsCount; ++word){
+            words.append(QString(1 + random.bounded(10), QChar('a' + random.bounded(26))));
+        }
+        message.text = words.join(' ');
+
+        postTime += random.bounded(60000);
+        message.postTime = QString::number(postTime);
+        messages->push_back(std::move(message));
+    }
+    return messages;
+}
+
+struct Measurement{
+    std::vector<qint64> times;
+    int items;
+};
+
+//Setup runs before each iteration and is not timed
+Measurement measure(const int iterations, const int items,
+                    const std::function<void()>& setup, const std::function<void()>& run){
+    Measurement measurement{{}, items};
+    for(int i = 0; i < iterations; ++i){
+        setup();
+        QElapsedTimer timer;
+        timer.start();
+        run();
+        measurement.times.push_back(timer.nsecsElapsed());
+    }
+    return measurement;
+}
+
+QJsonObject resultToJson(const QString& name, const int size, Measurement measurement){
+    std::sort(measurement.times.begin(), measurement.times.end());
+    auto median = measurement.times[measurement.times.size() / 2];
+    auto total = std::accumulate(measurement.times.begin(), measurement.times.end(), qint64(0));
+
+    return QJsonObject{
+        {"name", name},
+        {"size", size},
+        {"iterations", static_cast<int>(measurement.times.size())},
+        {"minMs", measurement.times.front() / 1e6},
+        {"medianMs", median / 1e6},
+        {"meanMs", total / 1e6 / measurement.times.size()},
+        {"medianPerItemNs", measurement.items > 0 ? static_cast<double>(median) / measurement.items : 0.0}
+    };
+}
+
+QJsonArray benchmarkModel(const ChatHistory& history, const int iterations){
+    QJsonArray results;
+    auto size = static_cast<int>(history->size());
+
+    std::unique_ptr<MessageModel> model;
+    auto newModel = [&model](){
+        model = std::make_unique<MessageModel>();
+    };
+    results.append(resultToJson("MessageModel::setMessages/reset", size,
+                                measure(iterations, size, newModel, [&](){
+        model->setMessages(history);
+    })));
+
+    //Merge path taken by chat updates, the last percent of messages is new, at least one
+    auto knownHistory = std::make_shared<std::vector<ChatMessageData>>(history->begin(),
+                                                                       history->end() - std::max(1, size / 100));
+    results.append(resultToJson("MessageModel::setMessages/merge", size,
+                                measure(iterations, size, [&](){
+        newModel();
+        model->setMessages(knownHistory);
+    }, [&](){
+        model->setMessages(history);
+    })));
+
+    newModel();
+    model->setMessages(history);
+    //Time texts are cached by the model, changing the format drops them so every pass is the first one
+    bool longTimeFormat = false;
+    auto dropTimeTexts = [&](){
+        longTimeFormat = !longTimeFormat;
+        model->setTimeFormat(longTimeFormat ? "hh:mm:ss dd.MM.yyyy" : "hh:mm dd.MM.yyyy");
+    };
+    for(auto role : MODEL_ROLES){
+        results.append(resultToJson(QString("MessageModel::data/") + roleName(role), size,
+                                    measure(iterations, size, dropTimeTexts, [&](){
+            for(int row = 0; row < size; ++row){
+                model->data(model->index(row), role);
+            }
+        })));
+    }
+
+    //Per row cost of the time before it was parsed once and cached: the text of the post time
+    //was parsed and formatted again on every call
+    const QString timeFormat = "hh:mm dd.MM.yyyy";
+    results.append(resultToJson("MessageModel::data/TimeText/parsedOnEveryCall", size,
+                                measure(iterations, size, [](){}, [&](){
+        for(const auto& message : *history){
+            QDateTime::fromMSecsSinceEpoch(message.postTime.toLongLong()).toString(timeFormat);
+        }
+    })));
+    //Same rows once their texts are cached, as repaints see them
+    results.append(resultToJson("MessageModel::data/TimeText/cached", size,
+                                measure(iterations, size, [](){}, [&](){
+        for(int row = 0; row < size; ++row){
+            model->data(model->index(row), MessageDataRole::TimeText);
+        }
+    })));
+
+    return results;
+}
+
+QJsonArray benchmarkDelegate(const ChatHistory& history, const int iterations, QWidget& styleWidget){
+    QJsonArray results;
+    auto size = static_cast<int>(history->size());
+
+    MessageModel model;
+    model.setMessages(history);
+    MessageItemDelegate delegate;
+    delegate.setWidth(VIEWER_SIZE.width());
+
+    QStyleOptionViewItem option;
+    option.initFrom(&styleWidget);
+    option.rect = QRect(QPoint(0, 0), QSize(VIEWER_SIZE.width(), 0));
+
+    auto sizeHints = [&](){
+        for(int row = 0; row < size; ++row){
+            delegate.sizeHint(option, model.index(row));
+        }
+    };
+    results.append(resultToJson("MessageItemDelegate::sizeHint/cold", size,
+                                measure(iterations, size, [&](){
+        delegate.clearCaches();
+    }, sizeHints)));
+    results.append(resultToJson("MessageItemDelegate::sizeHint/cached", size,
+                                measure(iterations, size, sizeHints, sizeHints)));
+
+    //Only a screenful is ever painted at once, so painting is measured for a fixed number of rows
+    auto paintedRows = std::min(size, PAINTED_ROWS);
+    QImage image(VIEWER_SIZE, QImage::Format_ARGB32_Premultiplied);
+    auto paint = [&](){
+        QPainter painter(&image);
+        for(int row = 0; row < paintedRows; ++row){
+            auto index = model.index(row);
+            option.rect.setHeight(delegate.sizeHint(option, index).height());
+            delegate.paint(&painter, option, index);
+        }
+    };
+    results.append(resultToJson("MessageItemDelegate::paint/cold", size,
+                                measure(iterations, paintedRows, [&](){
+        delegate.clearCaches();
+    }, paint)));
+    results.append(resultToJson("MessageItemDelegate::paint/cached", size,
+                                measure(iterations, paintedRows, paint, paint)));
+
+    return results;
+}
+
+QJsonArray benchmarkViewer(const ChatHistory& history, const int iterations){
+    QJsonArray results;
+    auto size = static_cast<int>(history->size());
+
+    MessageModel model;
+    model.setMessages(history);
+
+    //Batched layout spreads the same work over the event loop, single pass measures all of it at once
+    std::unique_ptr<MessagesViewer> viewer;
+    auto newViewer = [&](){
+        viewer = std::make_unique<MessagesViewer>();
+        viewer->setLayoutMode(QListView::SinglePass);
+        viewer->resize(VIEWER_SIZE);
+        viewer->show();
+        QCoreApplication::processEvents();
+    };
+    results.append(resultToJson("MessagesViewer::layout", size,
+                                measure(iterations, size, newViewer, [&](){
+        viewer->setModel(&model);
+        viewer->doItemsLayout();
+        viewer->scrollToBottom();
+    })));
+
+    //Sizes measured at the resized width are dropped, so every resize measures wrapping anew
+    results.append(resultToJson("MessagesViewer::resize", size,
+                                measure(iterations, size, [&](){
+        viewer->resize(VIEWER_SIZE);
+        static_cast<MessageItemDelegate*>(viewer->itemDelegate())->clearCaches();
+        viewer->doItemsLayout();
+        QCoreApplication::processEvents();
+    }, [&](){
+        viewer->resize(RESIZED_VIEWER_WIDTH, VIEWER_SIZE.height());
+        viewer->doItemsLayout();
+    })));
+
+    results.append(resultToJson("MessagesViewer::paint", size,
+                                measure(iterations, 0, [](){}, [&](){
+        viewer->viewport()->repaint();
+    })));
+
+    //Time texts change for every row at once, rows keep their heights so only a repaint should follow
+    bool longTimeFormat = false;
+    results.append(resultToJson("MessagesViewer::setTimeFormat", size,
+                                measure(iterations, size, [](){}, [&](){
+        longTimeFormat = !longTimeFormat;
+        model.setTimeFormat(longTimeFormat ? "hh:mm:ss dd.MM.yyyy" : "hh:mm dd.MM.yyyy");
+        QCoreApplication::processEvents();
+        viewer->viewport()->repaint();
+    })));
+
+    viewer.reset();
+    return results;
+}
+
+//History response is the largest message on the wire, each encoding is measured with its size
+QJsonArray benchmarkWireFormat(const ChatHistory& history, const int iterations){
+    QJsonArray results;
+    auto size = static_cast<int>(history->size());
+    auto responseDocument = GetHistoryResponseMessage(*history).toJson();
+
+    for(auto encoding : {WireEncoding::Json, WireEncoding::Cbor}){
+        QString encodingName = encoding == WireEncoding::Json ? "Json" : "Cbor";
+        QByteArray data;
+        auto encodeResult = resultToJson("WireFormat::encodeMessage/" + encodingName, size,
+                                         measure(iterations, size, [](){}, [&](){
+            data = WireFormat::encodeMessage(responseDocument, encoding);
+        }));
+        encodeResult.insert("bytes", data.size());
+        results.append(encodeResult);
+
+        //Generic decoding builds the whole document, CBOR is read as a stream into it like JSON is parsed
+        QJsonDocument document;
+        QString errorString;
+        results.append(resultToJson("WireFormat::decodeMessage/" + encodingName, size,
+                                    measure(iterations, size, [](){}, [&](){
+            WireFormat::decodeMessage(data, document, errorString);
+        })));
+
+        //Decoding used for responses, chat messages are built directly
+        QJsonObject object;
+        std::vector<ChatMessageData> decodedHistory;
+        results.append(resultToJson("WireFormat::decodeMessage/" + encodingName + "History", size,
+                                    measure(iterations, size, [](){}, [&](){
+            WireFormat::decodeMessage(data, object, decodedHistory, errorString);
+        })));
+    }
+
+    return results;
+}
+
+//Snapshot is shared with the model and copied once, into the store columns. A copy of the whole
+//vector would show up as an allocation of its size, a second copy of the messages as twice the bytes
+QJsonObject checkSnapshotCopies(bool& passed){
+    auto history = syntheticHistory(ALLOCATION_CHECK_SIZE);
+    MessageModel model;
+
+    allocationCounts = AllocationCounts();
+    allocationCounts.watchedSize = history->size() * sizeof(ChatMessageData);
+    allocationCounts.enabled = true;
+    model.setMessages(history);
+    allocationCounts.enabled = false;
+
+    auto storeBytes = model.getStore().memoryUsage();
+    quint64 snapshotCopies = allocationCounts.watchedAllocations;
+    //Columns grow by doubling at most, which allocates up to twice what they end with
+    passed = snapshotCopies == 0 && allocationCounts.bytes <= 2 * static_cast<quint64>(storeBytes);
+
+    return QJsonObject{
+        {"name", "MessageModel::setMessages/copies"},
+        {"size", ALLOCATION_CHECK_SIZE},
+        {"snapshotCopies", static_cast<qint64>(snapshotCopies)},
+        {"allocations", static_cast<qint64>(allocationCounts.allocations)},
+        {"allocatedBytes", static_cast<qint64>(allocationCounts.bytes)},
+        {"storeBytes", static_cast<qint64>(storeBytes)},
+        {"passed", passed}
+    };
+}
+
+int main(int argc, char *argv[])
+{
+    if(qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")){
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication application(argc, argv);
+    QLoggingCategory::setFilterRules("*.debug=false");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures the message model, delegate, viewer and wire format on synthetic chats");
+    parser.addHelpOption();
+    QCommandLineOption sizesOption("sizes", "Comma separated numbers of messages.", "sizes");
+    QCommandLineOption iterationsOption("iterations", "Runs of each benchmark.", "count",
+                                        QString::number(DEFAULT_ITERATIONS));
+    QCommandLineOption outputOption("output", "JSON file for results, printed if not set.", "file");
+    parser.addOptions({sizesOption, iterationsOption, outputOption});
+    parser.process(application);
+
+    auto sizes = DEFAULT_SIZES;
+    if(parser.isSet(sizesOption)){
+        sizes.clear();
+        for(const auto& size : parser.value(sizesOption).split(',', Qt::SkipEmptyParts)){
+            sizes.append(size.toInt());
+        }
+    }
+    auto iterations = std::max(1, parser.value(iterationsOption).toInt());
+
+    QWidget styleWidget;
+    QJsonArray results;
+    for(auto size : sizes){
+        if(size <= 0){
+            continue;
+        }
+        qInfo() << "Benchmarking" << size << "messages";
+        auto history = syntheticHistory(size);
+        for(const auto& resultsPart : {benchmarkModel(history, iterations),
+                                       benchmarkDelegate(history, iterations, styleWidget),
+                                       benchmarkViewer(history, iterations),
+                                       benchmarkWireFormat(history, iterations)}){
+            for(const auto& result : resultsPart){
+                results.append(result);
+            }
+        }
+    }
+
+    bool copiesCheckPassed = false;
+    auto copiesCheck = checkSnapshotCopies(copiesCheckPassed);
+    if(!copiesCheckPassed){
+        qWarning() << "Chat history is copied more than once into the model:" << copiesCheck;
+    }
+
+    QJsonObject report{
+        {"qtVersion", qVersion()},
+        {"platform", QGuiApplication::platformName()},
+        {"iterations", iterations},
+        {"results", results},
+        {"copiesCheck", copiesCheck}
+    };
+    auto reportData = QJsonDocument(report).toJson(QJsonDocument::Indented);
+
+    if(!parser.isSet(outputOption)){
+        QTextStream(stdout) << reportData;
+        return copiesCheckPassed ? 0 : 1;
+    }
+
+    QSaveFile file(parser.value(outputOption));
+    if(!file.open(QIODevice::WriteOnly)){
+        qWarning() << "Can't write results to" << file.fileName() << ":" << file.errorString();
+        return 1;
+    }
+    file.write(reportData);
+    return file.commit() && copiesCheckPassed ? 0 : 1;
+}
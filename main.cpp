@@ -3,6 +3,13 @@
 #include <QApplication>
 #include <QLocale>
 #include <QTranslator>
+#include <QSettings>
+#include <QThread>
+
+#include "Trace.h"
+
+//Tracing is off unless a file is given in the environment or in the settings
+const char* TRACE_FILE_VARIABLE = "CLIENT_TRACE_FILE";
 
 int main(int argc, char *argv[])
 {
@@ -17,7 +24,19 @@ int main(int argc, char *argv[])
             break;
         }
     }
-    MainWidget w;
-    w.show();
-    return a.exec();
+    QThread::currentThread()->setObjectName("GUI");
+    auto traceFile = qEnvironmentVariable(TRACE_FILE_VARIABLE, QSettings().value("traceFile").toString());
+    if(!traceFile.isEmpty()){
+        Trace::start(traceFile);
+    }
+
+    int result;
+    {
+        MainWidget w;
+        w.show();
+        result = a.exec();
+    }
+
+    Trace::stop();
+    return result;
 }
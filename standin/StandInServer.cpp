@@ -0,0 +1,428 @@
+#include "StandInServer.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QDateTime>
+#include <QPointer>
+
+#include "MessageType.h"
+#include "MessageUtils.h"
+#include "NewSessionRequestMessage.h"
+#include "NewSessionResponseMessage.h"
+#include "GetHistoryMessage.h"
+#include "GetHistoryResponseMessage.h"
+#include "AddMessageMessage.h"
+#include "AddMessageResponseMessage.h"
+#include "NotificationMessage.h"
+#include "Result.h"
+#include "NotificationType.h"
+
+#include "TcpDataTransmitter.h"
+
+#include "NewChatMessageData.h"
+
+#include <algorithm>
+#include <functional>
+
+#include <QDebug>
+
+//Same keys as the client extensions of the protocol
+const QString REQUEST_ID_KEY = "RequestId";
+const QString FEATURES_KEY = "Features";
+const QString SINCE_MESSAGE_ID_KEY = "SinceMessageId";
+const QString BEFORE_MESSAGE_ID_KEY = "BeforeMessageId";
+const QString PAGE_SIZE_KEY = "PageSize";
+const QString HAS_OLDER_MESSAGES_KEY = "HasOlderMessages";
+const QString RESUME_SESSION_ID_KEY = "ResumeSessionId";
+const QString RESUMED_KEY = "Resumed";
+const QString SENT_MESSAGE_ID_KEY = "MessageId";
+const QString BATCH_KEY = "Batch";
+const QString BATCH_RESULTS_KEY = "Results";
+const QString BATCH_RESULT_SUCCESS_KEY = "Success";
+const QString MESSAGE_USERNAME_KEY = "Username";
+const QString MESSAGE_TEXT_KEY = "Text";
+
+const QString RESUME_SESSION_FEATURE = "resume";
+const QString BATCH_FEATURE = "batch";
+const QString CBOR_ENCODING_FEATURE = "cbor";
+const QString ZLIB_COMPRESSION_FEATURE = "zlib";
+
+const int HISTORY_USERNAMES_COUNT = 20;
+const int HISTORY_MAX_TEXT_WORDS = 40;
+const qint64 HISTORY_MESSAGES_INTERVAL = 60000;
+
+StandInServer::StandInServer(const StandInServerOptions &options, QObject *parent)
+    : QObject{parent},
+    options(options),
+    random(options.seed != 0 ? QRandomGenerator(options.seed) : QRandomGenerator::securelySeeded()),
+    lastPostTime(0)
+{
+    clock.start();
+    connect(&server, &QTcpServer::newConnection, this, &StandInServer::onNewConnection);
+    connect(&notificationStormTimer, &QTimer::timeout, this, &StandInServer::onNotificationStormTimeout);
+
+    generateHistory();
+}
+
+bool StandInServer::listen(const QHostAddress &address, const quint16 port)
+{
+    if(!server.listen(address, port)){
+        qWarning() << "Stand-in server can't listen: " << server.errorString();
+        return false;
+    }
+
+    if(options.notificationStormInterval > 0){
+        notificationStormTimer.start(options.notificationStormInterval);
+    }
+    qDebug() << "Stand-in server listening on " << server.serverAddress().toString() << ":" << server.serverPort()
+             << " with " << history.size() << " messages";
+    return true;
+}
+
+void StandInServer::close()
+{
+    notificationStormTimer.stop();
+    server.close();
+
+    for(auto socket : connections.keys()){
+        socket->abort();
+    }
+}
+
+quint16 StandInServer::serverPort() const
+{
+    return server.serverPort();
+}
+
+QString StandInServer::errorString() const
+{
+    return server.errorString();
+}
+
+void StandInServer::sendNotificationStorm(const int count)
+{
+    for(int i = 0; i < count; ++i){
+        notifyClients();
+    }
+}
+
+const std::vector<ChatMessageData> &StandInServer::getHistory() const
+{
+    return history;
+}
+
+const StandInServerStats &StandInServer::getStats() const
+{
+    return stats;
+}
+
+void StandInServer::generateHistory()
+{
+    history.reserve(options.historySize);
+    lastPostTime = QDateTime::currentMSecsSinceEpoch() - options.historySize * HISTORY_MESSAGES_INTERVAL;
+
+    for(int i = 0; i < options.historySize; ++i){
+        QStringList words;
+        auto wordsCount = 1 + random.bounded(HISTORY_MAX_TEXT_WORDS);
+        for(int word = 0; word < wordsCount; ++word){
+            words.append(QString(1 + random.bounded(10), QChar('a' + random.bounded(26))));
+        }
+
+        //Generated messages end before now, so live ones always come after them
+        addChatMessage(QString("user%1").arg(random.bounded(HISTORY_USERNAMES_COUNT)), words.join(' '),
+                       lastPostTime + random.bounded(HISTORY_MESSAGES_INTERVAL));
+    }
+}
+
+ChatMessageData &StandInServer::addChatMessage(const QString &username, const QString &text, const qint64 postTime)
+{
+    //Ids come from the seeded generator, so repeated runs serve the same history
+    QByteArray idBytes(16, Qt::Uninitialized);
+    for(int i = 0; i < idBytes.size(); ++i){
+        idBytes[i] = static_cast<char>(random.bounded(256));
+    }
+
+    ChatMessageData message;
+    message.id = QUuid::fromRfc4122(idBytes).toString();
+    message.username = username;
+    message.text = text;
+    message.postTime = QString::number(postTime);
+    lastPostTime = postTime;
+
+    history.push_back(std::move(message));
+    return history.back();
+}
+
+qint64 StandInServer::livePostTime() const
+{
+    //Messages sent in the same millisecond as the previous one must not go before it
+    return std::max(lastPostTime, QDateTime::currentMSecsSinceEpoch());
+}
+
+void StandInServer::processRequest(QTcpSocket *socket, const QByteArray &data)
+{
+    ++stats.requestsReceived;
+
+    auto requestData = WireFormat::isCompressedFrame(data) ? WireFormat::decompressFrame(data) : data;
+    QJsonDocument requestDocument;
+    QString parseErrorString;
+    if(requestData.isEmpty() || !WireFormat::decodeMessage(requestData, requestDocument, parseErrorString)){
+        qWarning() << "Stand-in server can't parse request: " << parseErrorString;
+        return;
+    }
+
+    if(options.disconnectRate > 0 && random.generateDouble() < options.disconnectRate){
+        ++stats.disconnects;
+        socket->abort();
+        return;
+    }
+
+    auto requestObject = requestDocument.object();
+    auto request = MessageUtils::createMessageFromJson(requestDocument);
+    auto& connection = connections[socket];
+
+    QJsonObject response;
+    std::function<void(Connection&)> afterResponse;
+    switch (request->getMessageType()) {
+        case MessageType::NewSessionRequest:{
+            response = newSessionResponse(connection, requestObject,
+                                          std::dynamic_pointer_cast<NewSessionRequestMessage>(request));
+            //Extensions are agreed on in this response, so they apply to the frames after it
+            auto features = requestObject.value(FEATURES_KEY).toArray();
+            afterResponse = [this, features](Connection& connection){
+                if(options.supportsCbor && features.contains(CBOR_ENCODING_FEATURE)){
+                    connection.encoding = WireEncoding::Cbor;
+                }
+                connection.compressFrames = options.supportsCompression &&
+                                            features.contains(ZLIB_COMPRESSION_FEATURE);
+            };
+            break;
+        }
+        case MessageType::GetHistory:
+            response = historyResponse(requestObject);
+            break;
+        case MessageType::AddMessage:
+            response = addMessageResponse(requestObject, std::dynamic_pointer_cast<AddMessageMessage>(request));
+            notifyClients();
+            break;
+        default:
+            //Session confirmation and anything else needs no response
+            return;
+    }
+
+    if(options.dropRate > 0 && random.generateDouble() < options.dropRate){
+        ++stats.responsesDropped;
+        return;
+    }
+    sendResponse(socket, response, afterResponse);
+}
+
+QJsonObject StandInServer::newSessionResponse(Connection &connection, const QJsonObject &requestObject,
+                                              std::shared_ptr<NewSessionRequestMessage> request)
+{
+    auto userId = request->getUserId().isNull() ? QUuid::createUuid() : request->getUserId();
+
+    bool resumed = false;
+    QUuid sessionId;
+    auto resumeSessionId = QUuid::fromString(requestObject.value(RESUME_SESSION_ID_KEY).toString());
+    if(options.supportsResume && !resumeSessionId.isNull() && sessions.value(resumeSessionId) == userId){
+        resumed = true;
+        sessionId = resumeSessionId;
+    }
+    else{
+        sessionId = QUuid::createUuid();
+        sessions.insert(sessionId, userId);
+    }
+    connection.sessionId = sessionId;
+
+    NewSessionResponseMessage responseMessage(!request->getUsername().isEmpty(), userId, sessionId);
+    auto response = responseMessage.toJson().object();
+
+    QJsonArray features;
+    if(options.supportsResume){
+        features.append(RESUME_SESSION_FEATURE);
+        response.insert(RESUMED_KEY, resumed);
+    }
+    if(options.supportsBatch){
+        features.append(BATCH_FEATURE);
+    }
+    if(options.supportsCbor){
+        features.append(CBOR_ENCODING_FEATURE);
+    }
+    if(options.supportsCompression){
+        features.append(ZLIB_COMPRESSION_FEATURE);
+    }
+    response.insert(FEATURES_KEY, features);
+    if(options.echoesRequestIds){
+        response.insert(REQUEST_ID_KEY, requestObject.value(REQUEST_ID_KEY));
+    }
+    return response;
+}
+
+QJsonObject StandInServer::historyResponse(const QJsonObject &requestObject) const
+{
+    auto findMessage = [this](const QString& messageId){
+        return std::find_if(history.begin(), history.end(), [&messageId](const ChatMessageData& message){
+            return message.id == messageId;
+        });
+    };
+
+    auto first = history.begin();
+    auto last = history.end();
+    QJsonObject extensions;
+
+    auto sinceMessageId = requestObject.value(SINCE_MESSAGE_ID_KEY).toString();
+    auto pageSize = requestObject.value(PAGE_SIZE_KEY).toInt();
+    //Older servers always send the full history
+    if(!options.supportsPaging){
+        sinceMessageId.clear();
+        pageSize = 0;
+    }
+
+    if(!sinceMessageId.isEmpty()){
+        auto sinceMessage = findMessage(sinceMessageId);
+        //Unknown marker gets the full history, as older servers do
+        if(sinceMessage != history.end()){
+            first = sinceMessage + 1;
+            extensions.insert(SINCE_MESSAGE_ID_KEY, sinceMessageId);
+        }
+    }
+    else if(pageSize > 0){
+        auto beforeMessageId = requestObject.value(BEFORE_MESSAGE_ID_KEY).toString();
+        if(!beforeMessageId.isEmpty()){
+            last = findMessage(beforeMessageId);
+        }
+        first = last - std::min<qint64>(pageSize, last - history.begin());
+        extensions.insert(PAGE_SIZE_KEY, pageSize);
+        extensions.insert(HAS_OLDER_MESSAGES_KEY, first != history.begin());
+    }
+
+    GetHistoryResponseMessage responseMessage(std::vector<ChatMessageData>(first, last));
+    auto response = responseMessage.toJson().object();
+    for(auto it = extensions.constBegin(); it != extensions.constEnd(); ++it){
+        response.insert(it.key(), it.value());
+    }
+    if(options.echoesRequestIds){
+        response.insert(REQUEST_ID_KEY, requestObject.value(REQUEST_ID_KEY));
+    }
+    return response;
+}
+
+QJsonObject StandInServer::addMessageResponse(const QJsonObject &requestObject, std::shared_ptr<AddMessageMessage> request)
+{
+    AddMessageResponseMessage responseMessage(Result::Success);
+    auto response = responseMessage.toJson().object();
+
+    auto batch = requestObject.value(BATCH_KEY).toArray();
+    if(options.supportsBatch && !batch.isEmpty()){
+        QJsonArray results;
+        for(const auto& entry : batch){
+            auto entryObject = entry.toObject();
+            const auto& message = addChatMessage(entryObject.value(MESSAGE_USERNAME_KEY).toString(),
+                                                 entryObject.value(MESSAGE_TEXT_KEY).toString(),
+                                                 livePostTime());
+            results.append(QJsonObject{
+                {BATCH_RESULT_SUCCESS_KEY, true},
+                {SENT_MESSAGE_ID_KEY, message.id}
+            });
+        }
+        response.insert(BATCH_RESULTS_KEY, results);
+    }
+    else{
+        auto chatMessage = request->getMessage();
+        response.insert(SENT_MESSAGE_ID_KEY, addChatMessage(chatMessage.username, chatMessage.text,
+                                                             livePostTime()).id);
+    }
+
+    if(options.echoesRequestIds){
+        response.insert(REQUEST_ID_KEY, requestObject.value(REQUEST_ID_KEY));
+    }
+    return response;
+}
+
+void StandInServer::notifyClients()
+{
+    auto notification = NotificationMessage(NotificationType::MessagesUpdated).toJson().object();
+    for(auto socket : connections.keys()){
+        if(sendMessage(socket, notification)){
+            ++stats.notificationsSent;
+        }
+    }
+}
+
+int StandInServer::responseDelay(Connection &connection)
+{
+    //Jitter delays a reply, but like on a TCP stream it waits for the ones before it
+    auto now = clock.elapsed();
+    auto dueTime = now + options.latency + (options.jitter > 0 ? random.bounded(options.jitter + 1) : 0);
+    connection.lastResponseTime = std::max(connection.lastResponseTime, dueTime);
+    return static_cast<int>(connection.lastResponseTime - now);
+}
+
+void StandInServer::sendResponse(QTcpSocket *socket, const QJsonObject &response,
+                                 const std::function<void(Connection&)>& afterResponse)
+{
+    //Socket may be gone when the delay ends, the response is lost then like on a real network
+    QPointer<QTcpSocket> responseSocket(socket);
+    auto send = [this, responseSocket, response, afterResponse](){
+        if(responseSocket == nullptr || !connections.contains(responseSocket)){
+            return;
+        }
+        if(sendMessage(responseSocket, response)){
+            ++stats.responsesSent;
+        }
+        if(afterResponse){
+            afterResponse(connections[responseSocket]);
+        }
+    };
+
+    //Precise timers due in order fire in order, coarse ones may be moved past each other
+    auto delay = responseDelay(connections[socket]);
+    if(delay <= 0){
+        send();
+    }
+    else{
+        QTimer::singleShot(delay, Qt::PreciseTimer, this, send);
+    }
+}
+
+bool StandInServer::sendMessage(QTcpSocket *socket, const QJsonObject &message)
+{
+    const auto& connection = connections[socket];
+    auto data = WireFormat::encodeMessage(QJsonDocument(message), connection.encoding);
+    if(connection.compressFrames && data.size() >= options.compressionThreshold){
+        data = WireFormat::compressFrame(data);
+    }
+    return TcpDataTransmitter::sendData(data, *socket);
+}
+
+void StandInServer::onNewConnection()
+{
+    while(server.hasPendingConnections()){
+        auto socket = server.nextPendingConnection();
+        connections.insert(socket, Connection());
+        ++stats.connections;
+
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket](){
+            for(const auto& data : TcpDataTransmitter::receiveData(*socket)){
+                //Request may have closed the connection
+                if(!connections.contains(socket)){
+                    return;
+                }
+                processRequest(socket, data);
+            }
+        });
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket](){
+            connections.remove(socket);
+            socket->deleteLater();
+            emit clientDisconnected();
+        });
+
+        emit clientConnected();
+    }
+}
+
+void StandInServer::onNotificationStormTimeout()
+{
+    sendNotificationStorm(options.notificationStormSize);
+}
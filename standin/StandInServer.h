@@ -0,0 +1,106 @@
+#ifndef STANDINSERVER_H
+#define STANDINSERVER_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QHash>
+#include <QUuid>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include "StandInServerOptions.h"
+#include "WireFormat.h"
+#include "ChatMessageData.h"
+
+#include <memory>
+#include <functional>
+#include <vector>
+
+class NewSessionRequestMessage;
+class AddMessageMessage;
+
+struct StandInServerStats{
+    quint64 connections = 0;
+    quint64 requestsReceived = 0;
+    quint64 responsesSent = 0;
+    quint64 responsesDropped = 0;
+    quint64 disconnects = 0;
+    quint64 notificationsSent = 0;
+};
+
+//Local server speaking the chat protocol with injected delays and failures, for load and latency tests.
+//It keeps everything in memory and runs on the thread it was created on
+class StandInServer : public QObject
+{
+    Q_OBJECT
+
+    struct Connection{
+        WireEncoding encoding = WireEncoding::Json;
+        bool compressFrames = false;
+        QUuid sessionId;
+        //Time on the server clock when the last scheduled response goes out, replies never overtake it
+        qint64 lastResponseTime = 0;
+    };
+
+public:
+    explicit StandInServer(const StandInServerOptions& options = StandInServerOptions(),
+                           QObject *parent = nullptr);
+
+    //Port zero picks a free one, see serverPort()
+    bool listen(const QHostAddress& address = QHostAddress::LocalHost, const quint16 port = 0);
+    void close();
+    quint16 serverPort() const;
+    QString errorString() const;
+
+    //Sends notifications to every client right away, storms from options are sent the same way
+    void sendNotificationStorm(const int count);
+
+    const std::vector<ChatMessageData>& getHistory() const;
+    const StandInServerStats& getStats() const;
+
+signals:
+    void clientConnected();
+    void clientDisconnected();
+
+private:
+    StandInServerOptions options;
+    QTcpServer server;
+    QRandomGenerator random;
+    QTimer notificationStormTimer;
+    QElapsedTimer clock;
+
+    QHash<QTcpSocket*, Connection> connections;
+    //User ids of sessions given out so far, clients may resume them after reconnecting
+    QHash<QUuid, QUuid> sessions;
+
+    std::vector<ChatMessageData> history;
+    qint64 lastPostTime;
+
+    StandInServerStats stats;
+
+    void generateHistory();
+    ChatMessageData& addChatMessage(const QString& username, const QString& text, const qint64 postTime);
+    qint64 livePostTime() const;
+
+    void processRequest(QTcpSocket* socket, const QByteArray& data);
+    QJsonObject newSessionResponse(Connection& connection, const QJsonObject& requestObject,
+                                   std::shared_ptr<NewSessionRequestMessage> request);
+    QJsonObject historyResponse(const QJsonObject& requestObject) const;
+    QJsonObject addMessageResponse(const QJsonObject& requestObject, std::shared_ptr<AddMessageMessage> request);
+    void notifyClients();
+
+    int responseDelay(Connection& connection);
+    void sendResponse(QTcpSocket* socket, const QJsonObject& response,
+                      const std::function<void(Connection&)>& afterResponse = nullptr);
+    bool sendMessage(QTcpSocket* socket, const QJsonObject& message);
+
+private slots:
+    void onNewConnection();
+    void onNotificationStormTimeout();
+};
+
+#endif // STANDINSERVER_H
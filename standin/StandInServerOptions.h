@@ -0,0 +1,36 @@
+#ifndef STANDINSERVEROPTIONS_H
+#define STANDINSERVEROPTIONS_H
+
+#include <QtGlobal>
+
+struct StandInServerOptions{
+    //Messages the server starts with
+    int historySize = 1000;
+
+    //Every response waits latency plus a random part of jitter, in milliseconds
+    int latency = 0;
+    int jitter = 0;
+
+    //Chances for each request to get no response or to close the connection instead of answering
+    double dropRate = 0.0;
+    double disconnectRate = 0.0;
+
+    //Bursts of notifications sent to every client, none while the interval is zero
+    int notificationStormInterval = 0;
+    int notificationStormSize = 100;
+
+    //Protocol extensions can be switched off to act as an older server
+    bool supportsResume = true;
+    bool supportsBatch = true;
+    //Covers both updates since a message and pages before one
+    bool supportsPaging = true;
+    bool echoesRequestIds = true;
+    bool supportsCbor = true;
+    bool supportsCompression = true;
+    int compressionThreshold = 1024;
+
+    //Zero seeds the random generator randomly, others make runs repeatable
+    quint32 seed = 0;
+};
+
+#endif // STANDINSERVEROPTIONS_H
@@ -0,0 +1,65 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+
+#include "StandInServer.h"
+
+#include <QDebug>
+
+const quint16 DEFAULT_PORT = 44000;
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication application(argc, argv);
+
+    StandInServerOptions options;
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Local stand-in of the chat server for load and latency testing");
+    parser.addHelpOption();
+    QCommandLineOption portOption("port", "Port to listen on.", "port", QString::number(DEFAULT_PORT));
+    QCommandLineOption historyOption("history", "Messages in the initial history.", "count",
+                                     QString::number(options.historySize));
+    QCommandLineOption latencyOption("latency", "Delay of every response in ms.", "ms",
+                                     QString::number(options.latency));
+    QCommandLineOption jitterOption("jitter", "Random extra delay of responses, up to this many ms.", "ms",
+                                    QString::number(options.jitter));
+    QCommandLineOption dropRateOption("drop-rate", "Chance for a request to get no response, 0 to 1.", "rate",
+                                      QString::number(options.dropRate));
+    QCommandLineOption disconnectRateOption("disconnect-rate", "Chance for a request to close the connection, 0 to 1.",
+                                            "rate", QString::number(options.disconnectRate));
+    QCommandLineOption stormIntervalOption("storm-interval", "Interval of notification storms in ms, 0 for none.",
+                                           "ms", QString::number(options.notificationStormInterval));
+    QCommandLineOption stormSizeOption("storm-size", "Notifications sent to each client in one storm.", "count",
+                                       QString::number(options.notificationStormSize));
+    QCommandLineOption legacyOption("legacy", "Act as a server without protocol extensions.");
+    QCommandLineOption seedOption("seed", "Seed of the random generator, 0 for a random one.", "seed",
+                                  QString::number(options.seed));
+    parser.addOptions({portOption, historyOption, latencyOption, jitterOption, dropRateOption,
+                       disconnectRateOption, stormIntervalOption, stormSizeOption, legacyOption, seedOption});
+    parser.process(application);
+
+    options.historySize = parser.value(historyOption).toInt();
+    options.latency = parser.value(latencyOption).toInt();
+    options.jitter = parser.value(jitterOption).toInt();
+    options.dropRate = parser.value(dropRateOption).toDouble();
+    options.disconnectRate = parser.value(disconnectRateOption).toDouble();
+    options.notificationStormInterval = parser.value(stormIntervalOption).toInt();
+    options.notificationStormSize = parser.value(stormSizeOption).toInt();
+    options.seed = parser.value(seedOption).toUInt();
+    if(parser.isSet(legacyOption)){
+        options.supportsResume = false;
+        options.supportsBatch = false;
+        options.supportsPaging = false;
+        options.echoesRequestIds = false;
+        options.supportsCbor = false;
+        options.supportsCompression = false;
+    }
+
+    StandInServer server(options);
+    if(!server.listen(QHostAddress::LocalHost, parser.value(portOption).toUShort())){
+        qCritical() << "Can't start stand-in server: " << server.errorString();
+        return 1;
+    }
+
+    return application.exec();
+}